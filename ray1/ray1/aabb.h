@@ -48,46 +48,37 @@ public:
 
     bool hit(const ray& r, interval ray_t) const
     {
-        const point3& ray_orig = r.origin();
-        const vec3& ray_dir = r.direction();
+        // Branchless slab test. The ray's cached direction signs pick the near and far plane
+        // of each slab, so no per-axis division or t0/t1 swap is needed; the min/max chain
+        // compiles to straight-line code the compiler can vectorize.
 
-        for (int axis = 0; axis < 3; axis++)
-        {
-            const interval& ax = axis_interval(axis);
-            const double adinv = 1.0 / ray_dir[axis];
-
-            double t0 = (ax.min - ray_orig[axis]) * adinv;
-            double t1 = (ax.max - ray_orig[axis]) * adinv;
-
-            if (t0 < t1)
-            {
-                if (t0 > ray_t.min)
-                {
-                    ray_t.min = t0;
-				}
-				if (t1 < ray_t.max)
-				{
-					ray_t.max = t1;
-				}
-            }
-            else
-            {
-                if (t1 > ray_t.min)
-                {
-                    ray_t.min = t1;
-                }
-                if (t0 < ray_t.max)
-                {
-                    ray_t.max = t0;
-                }
-            }
-
-            if (ray_t.max <= ray_t.min)
-            {
-                return false;
-            }
-        }
-        return true;
+        const point3& orig = r.origin();
+        const vec3& inv_dir = r.inv_direction();
+
+        double tx_near = ((r.dir_sign(0) ? x.max : x.min) - orig.x()) * inv_dir.x();
+        double tx_far  = ((r.dir_sign(0) ? x.min : x.max) - orig.x()) * inv_dir.x();
+        double ty_near = ((r.dir_sign(1) ? y.max : y.min) - orig.y()) * inv_dir.y();
+        double ty_far  = ((r.dir_sign(1) ? y.min : y.max) - orig.y()) * inv_dir.y();
+        double tz_near = ((r.dir_sign(2) ? z.max : z.min) - orig.z()) * inv_dir.z();
+        double tz_far  = ((r.dir_sign(2) ? z.min : z.max) - orig.z()) * inv_dir.z();
+
+        double t_min = max_of(tx_near, max_of(ty_near, max_of(tz_near, ray_t.min)));
+        double t_max = min_of(tx_far, min_of(ty_far, min_of(tz_far, ray_t.max)));
+
+        return t_min < t_max;
+    }
+
+    double surface_area() const
+    {
+        double dx = x.size();
+        double dy = y.size();
+        double dz = z.size();
+        return 2.0 * (dx * dy + dy * dz + dz * dx);
+    }
+
+    point3 centroid() const
+    {
+        return point3((x.min + x.max) / 2, (y.min + y.max) / 2, (z.min + z.max) / 2);
     }
 
     int longest_axis() const
@@ -108,6 +99,11 @@ public:
 
 private:
 
+    // Plain comparisons rather than std::fmin/fmax, which compilers often cannot inline. A NaN
+    // in `a` (a ray lying in a slab plane) yields `b`, so `b` must be the running bound.
+    static double min_of(double a, double b) { return (a < b ? a : b); }
+    static double max_of(double a, double b) { return (a > b ? a : b); }
+
     void pad_to_minimums()
     {
         // Adjust the AABB so that no side is narrower than some delta, padding if necessary.
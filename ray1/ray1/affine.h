@@ -0,0 +1,188 @@
+#ifndef AFFINE_H
+#define AFFINE_H
+
+#include "aabb.h"
+
+struct affine_transform
+{
+    // Maps p to L p + t: the 3x3 linear part L fills the first three columns and the
+    // translation t the last. Composition follows matrix order, so (a * b) applies b first.
+
+    double m[3][4] = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 } };
+
+    static affine_transform translation(const vec3& offset)
+    {
+        affine_transform result;
+        for (int i = 0; i < 3; i++)
+        {
+            result.m[i][3] = offset[i];
+        }
+        return result;
+    }
+
+    static affine_transform scaling(const vec3& factors)
+    {
+        affine_transform result;
+        for (int i = 0; i < 3; i++)
+        {
+            result.m[i][i] = factors[i];
+        }
+        return result;
+    }
+
+    static affine_transform rotation(const vec3& axis, double degrees)
+    {
+        // Rodrigues' formula, counterclockwise about `axis` when it points at the viewer.
+        // About +y this is exactly the rotation rotate_y applies.
+
+        vec3 a = unit_vector(axis);
+        double radians = degrees_to_radians(degrees);
+        double s = std::sin(radians);
+        double c = std::cos(radians);
+        double k = 1 - c;
+
+        affine_transform result;
+        result.m[0][0] = c + k * a.x() * a.x();
+        result.m[0][1] = k * a.x() * a.y() - s * a.z();
+        result.m[0][2] = k * a.x() * a.z() + s * a.y();
+        result.m[1][0] = k * a.y() * a.x() + s * a.z();
+        result.m[1][1] = c + k * a.y() * a.y();
+        result.m[1][2] = k * a.y() * a.z() - s * a.x();
+        result.m[2][0] = k * a.z() * a.x() - s * a.y();
+        result.m[2][1] = k * a.z() * a.y() + s * a.x();
+        result.m[2][2] = c + k * a.z() * a.z();
+        return result;
+    }
+
+    affine_transform operator*(const affine_transform& b) const
+    {
+        affine_transform result;
+        for (int i = 0; i < 3; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                double sum = (j == 3 ? m[i][3] : 0.0);
+                for (int k = 0; k < 3; k++)
+                {
+                    sum += m[i][k] * b.m[k][j];
+                }
+                result.m[i][j] = sum;
+            }
+        }
+        return result;
+    }
+
+    affine_transform inverse() const
+    {
+        // Inverts the linear part through its adjugate, then maps the translation back
+        // through the result. L must not be singular.
+
+        double c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        double c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        double c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        double inv_det = 1 / (m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02);
+
+        affine_transform result;
+        result.m[0][0] = c00 * inv_det;
+        result.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+        result.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+        result.m[1][0] = c01 * inv_det;
+        result.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+        result.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+        result.m[2][0] = c02 * inv_det;
+        result.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+        result.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+
+        for (int i = 0; i < 3; i++)
+        {
+            result.m[i][3] = -(result.m[i][0] * m[0][3] + result.m[i][1] * m[1][3] + result.m[i][2] * m[2][3]);
+        }
+        return result;
+    }
+
+    point3 apply_point(const point3& p) const
+    {
+        return point3(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                      m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                      m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    vec3 apply_vector(const vec3& v) const
+    {
+        return vec3(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                    m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                    m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    vec3 apply_transposed(const vec3& v) const
+    {
+        // L^T v. Applied by the inverse of a transform, this carries normals through it.
+        return vec3(m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+                    m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+                    m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+    }
+
+    aabb apply_box(const aabb& box) const
+    {
+        // Arvo's method: each output extent starts at the translation and adds, for every
+        // input axis, the smaller and the larger of that axis's two products.
+
+        interval extents[3];
+        for (int i = 0; i < 3; i++)
+        {
+            double lower = m[i][3];
+            double upper = m[i][3];
+            for (int j = 0; j < 3; j++)
+            {
+                double a = m[i][j] * box.axis_interval(j).min;
+                double b = m[i][j] * box.axis_interval(j).max;
+                lower += std::fmin(a, b);
+                upper += std::fmax(a, b);
+            }
+            extents[i] = interval(lower, upper);
+        }
+        return aabb(extents[0], extents[1], extents[2]);
+    }
+
+    bool is_identity() const
+    {
+        affine_transform identity;
+        for (int i = 0; i < 3; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                if (m[i][j] != identity.m[i][j])
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    double determinant() const
+    {
+        // Of the linear part; negative when the transform mirrors.
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+             + m[0][1] * (m[1][2] * m[2][0] - m[1][0] * m[2][2])
+             + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+
+    vec3 translation_part() const
+    {
+        return vec3(m[0][3], m[1][3], m[2][3]);
+    }
+
+    double linear_norm() const
+    {
+        // Largest absolute row sum of L: no component grows by more than this factor.
+        double norm = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            norm = std::fmax(norm, std::fabs(m[i][0]) + std::fabs(m[i][1]) + std::fabs(m[i][2]));
+        }
+        return norm;
+    }
+};
+
+#endif
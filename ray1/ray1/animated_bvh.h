@@ -0,0 +1,83 @@
+#ifndef ANIMATED_BVH_H
+#define ANIMATED_BVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+class animated_bvh : public hittable
+{
+public:
+    // A BVH over objects that move between the frames of an animation. After moving them
+    // (sphere::set_motion, translate::set_offset, ...), call update(): it refits the tree in
+    // one linear pass and rebuilds it from scratch only once refitting has let its SAH cost
+    // grow past rebuild_threshold times the cost right after the last build.
+
+    animated_bvh(const hittable_list& list, bvh_build_mode mode = bvh_build_mode::binned_sah,
+                 double rebuild_threshold = 1.5, int thread_count = 0)
+        : objects(list), mode(mode), rebuild_threshold(rebuild_threshold), thread_count(thread_count)
+    {
+        rebuild();
+    }
+
+    bool update()
+    {
+        // Returns true if the tree was rebuilt rather than refit.
+
+        root->refit();
+        if (root->sah_cost() > rebuild_threshold * built_cost)
+        {
+            rebuild();
+            return true;
+        }
+        return false;
+    }
+
+    void rebuild()
+    {
+        // Wrappers such as translate cache their bounds; build from current ones.
+        objects.refit_bounds();
+        root = make_shared<bvh_node>(objects, mode, thread_count);
+        built_cost = root->sah_cost();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        return root->hit(r, ray_t, rec);
+    }
+
+    void hit_batch(const ray* rays, uint32_t* indices, size_t count, interval* intervals,
+                   hit_record* recs, char* did_hit) const override
+    {
+        root->hit_batch(rays, indices, count, intervals, recs, did_hit);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        return root->occluded(r, ray_t);
+    }
+
+    aabb bounding_box() const override { return root->bounding_box(); }
+
+    aabb refit_bounds() override
+    {
+        update();
+        return root->bounding_box();
+    }
+
+    void hash_content(uint64_t& hash) const override { root->hash_content(hash); }
+
+    double sah_cost() const { return root->sah_cost(); }
+    double built_sah_cost() const { return built_cost; }
+
+private:
+    hittable_list objects;
+    bvh_build_mode mode;
+    double rebuild_threshold;
+    int thread_count;
+    shared_ptr<bvh_node> root;
+    double built_cost = 0;
+};
+
+#endif
@@ -4,94 +4,1340 @@
 #include "aabb.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "linear_bvh.h"
+#include "motion_bvh.h"
+#include "parallel.h"
+#include "wide_bvh.h"
 
 #include <algorithm>
 
+enum class bvh_build_mode
+{
+    median_split,  // Sort along the longest axis and split at the median object
+    binned_sah,    // Pick the cheapest of the binned surface area heuristic splits
+    lbvh,          // Radix sort centroids along a Morton curve and split where the codes differ
+    lbvh_treelets  // lbvh, then rebuild every small treelet with its lowest-cost topology
+};
+
 class bvh_node : public hittable
 {
 public:
-    bvh_node(hittable_list list) : bvh_node(list.objects, 0, list.objects.size())
+    // Cost model shared by the SAH builder and sah_cost(), relative to one primitive test.
+    static constexpr double traversal_cost = 1.0;
+    static constexpr double intersection_cost = 1.0;
+    static constexpr int    sah_bin_count = 16;
+    static constexpr int    max_leaf_size = 4;
+    static constexpr int    treelet_size = 7;  // Leaves per treelet in lbvh_treelets builds
+
+    bvh_node(const hittable_list& list, bvh_build_mode mode = bvh_build_mode::binned_sah, int thread_count = 0)
     {
-        // There's a C++ subtlety here. This constructor (without span indices) creates an
-        // implicit copy of the hittable list, which we will modify. The lifetime of the copied
-        // list only extends until this constructor exits. That's OK, because we only need to
-        // persist the resulting bounding volume hierarchy.
+        // Every primitive's bounds and centroid are cached in a flat array up front, so no
+        // level of the build calls bounding_box() again. Nodes over many primitives are built
+        // first, on this thread, with the bounds, binning and partitioning of each spread
+        // across the workers; the subtrees below them are then built concurrently. Each step
+        // is deterministic, so every thread count produces the same tree. A thread_count of
+        // zero or less uses one worker per hardware thread.
+
+        int workers = resolve_thread_count(thread_count);
+        std::vector<bvh_primitive> primitives = cache_primitives(list.objects, 0, list.objects.size(), workers);
+
+        size_t task_size = (workers > 1 ? std::max(min_task_size, primitives.size() / (8 * size_t(workers))) : 0);
+        build_context context(list.objects, workers, task_size);
+
+        bool optimize = (mode == bvh_build_mode::lbvh_treelets);
+        std::vector<uint64_t> morton_codes;
+        if (mode == bvh_build_mode::lbvh || optimize)
+        {
+            morton_codes = sort_by_morton_code(primitives, workers);
+            context.morton_codes = morton_codes.data();
+        }
+
+        treelet_pass treelets;
+        if (optimize)
+        {
+            // BVHs passed in as objects belong to the caller; leave them as they are.
+            for (const shared_ptr<hittable>& object : list.objects)
+            {
+                if (dynamic_cast<const bvh_node*>(object.get()) != nullptr)
+                {
+                    treelets.foreign.push_back(object.get());
+                }
+            }
+            std::sort(treelets.foreign.begin(), treelets.foreign.end());
+        }
+
+        build(primitives, 0, primitives.size(), mode, context);
+
+        parallel_for(int(context.tasks.size()), workers, [&](int task, int worker)
+        {
+            const build_task& subtree = context.tasks[task];
+            build_context subtree_context(list.objects, 1, 0);
+            subtree_context.morton_codes = context.morton_codes;
+            subtree.node->build(primitives, subtree.start, subtree.end, mode, subtree_context);
+            if (optimize)
+            {
+                treelet scratch;
+                subtree.node->optimize_treelets(treelets, scratch);
+            }
+        });
+
+        if (optimize)
+        {
+            // The queued subtrees are optimized already; finish the nodes above them.
+            for (const build_task& subtree : context.tasks)
+            {
+                treelets.finished.push_back(subtree.node);
+            }
+            std::sort(treelets.finished.begin(), treelets.finished.end());
+            treelet scratch;
+            optimize_treelets(treelets, scratch);
+        }
     }
 
-    bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end)
+    bvh_node(const std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end)
     {
-        bbox = aabb::empty;
-        for (size_t object_index = start; object_index < end; object_index++)
+        // Serial median-split build over objects[start, end).
+        std::vector<bvh_primitive> primitives = cache_primitives(objects, start, end, 1);
+        build_context context(objects, 1, 0);
+        build_median(primitives, 0, primitives.size(), context);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (!bbox.hit(r, ray_t))
+        {
+            return false;
+        }
+
+        if (right == left)
         {
-            bbox = aabb(bbox, objects[object_index]->bounding_box());
+            return left->hit(r, ray_t, rec);
         }
 
+        // Visit the child on the near side of the split first. A hit there shortens the
+        // interval, so the far child's own box test rejects it when its box starts beyond the
+        // closest hit.
+        bool right_first = r.dir_sign(split_axis);
+        const hittable* near_child = (right_first ? right : left).get();
+        const hittable* far_child = (right_first ? left : right).get();
+
+        bool hit_near = near_child->hit(r, ray_t, rec);
+        bool hit_far = far_child->hit(r, interval(ray_t.min, hit_near ? rec.t : ray_t.max), rec);
+
+        return hit_near || hit_far;
+    }
+
+    void hit_batch(const ray* rays, uint32_t* indices, size_t count, interval* intervals,
+                   hit_record* recs, char* did_hit) const override
+    {
+        // Moves the rays that reach this node's box to the front of the batch, then hands
+        // that prefix to each child in turn, as hit() does for one ray. Children only reorder
+        // within the prefix, so the right child sees the same rays the left one did.
+
+        size_t reaching = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t k = indices[i];
+            if (bbox.hit(rays[k], intervals[k]))
+            {
+                indices[i] = indices[reaching];
+                indices[reaching++] = k;
+            }
+        }
+
+        if (reaching == 0)
+        {
+            return;
+        }
+
+        left->hit_batch(rays, indices, reaching, intervals, recs, did_hit);
+        if (right != left)
+        {
+            right->hit_batch(rays, indices, reaching, intervals, recs, did_hit);
+        }
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        if (!bbox.hit(r, ray_t))
+        {
+            return false;
+        }
+
+        return left->occluded(r, ray_t) || (right != left && right->occluded(r, ray_t));
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    aabb bounding_box_at(double time) const override
+    {
+        aabb box = left->bounding_box_at(time);
+        return (right == left ? box : aabb(box, right->bounding_box_at(time)));
+    }
+
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        left->hash_content(hash);
+        if (right != left)
+        {
+            right->hash_content(hash);
+        }
+    }
+
+    double sah_cost() const
+    {
+        // Returns the expected cost of tracing a ray through this tree under the surface area
+        // heuristic: every node is weighted by the probability that a ray hitting the root
+        // box also hits the node's box. Trees from different build modes can be compared
+        // directly; lower is better.
+
+        return subtree_cost() / bbox.surface_area();
+    }
+
+    void refit()
+    {
+        // Recomputes every box bottom-up from the primitives' current bounds, keeping the
+        // tree's topology: one linear pass with no sorting or partitioning, for primitives
+        // that moved since the build. The tree's quality degrades as they move away from
+        // where it was built; animated_bvh watches sah_cost() and rebuilds when needed.
+
+        bbox = left->refit_bounds();
+        if (right != left)
+        {
+            bbox = aabb(bbox, right->refit_bounds());
+        }
+    }
+
+    aabb refit_bounds() override
+    {
+        refit();
+        return bbox;
+    }
+
+    shared_ptr<linear_bvh> flatten() const
+    {
+        // Copies this tree into a linear_bvh: one contiguous array of 32-byte nodes in
+        // depth-first order, traversed with an explicit stack instead of a virtual hit() call
+        // and a pointer chase per node. The primitives are shared, not copied.
+
+        auto flat = make_shared<linear_bvh>();
+        flatten_node(*flat, 0);
+        return flat;
+    }
+
+    shared_ptr<motion_bvh> flatten_motion() const
+    {
+        // Copies this tree into a motion_bvh, as flatten() does, but with every node bounding
+        // its primitives at shutter open and at shutter close rather than over the whole
+        // interval. Rays test the box at their own time, so moving primitives no longer
+        // smear across the tree. The topology is this tree's.
+
+        auto flat = make_shared<motion_bvh>();
+        aabb box_open, box_close;
+        flatten_motion_node(*flat, 0, box_open, box_close);
+        return flat;
+    }
+
+    template<int Width>
+    shared_ptr<wide_bvh<Width>> collapse() const
+    {
+        // Copies this tree into a wide_bvh (bvh4 or bvh8). Each wide node gathers up to Width
+        // descendants of a binary node by repeatedly opening its largest interior child, so
+        // one node fetch and one SIMD box test stand in for up to log2(Width) binary levels.
+        // The primitives are shared, not copied.
+
+        auto wide = make_shared<wide_bvh<Width>>();
+        collapse_node(*wide, 0);
+        return wide;
+    }
+
+    void report_layouts(const std::vector<ray>& rays) const
+    {
+        // Traces `rays` through the binary, 4-wide and 8-wide copies of this tree and prints
+        // each layout's memory and work per ray to std::clog.
+
+        report_layout("BVH2", *flatten(), rays);
+        report_layout("BVH4", *collapse<4>(), rays);
+        report_layout("BVH8", *collapse<8>(), rays);
+    }
+
+private:
+    shared_ptr<hittable> left;
+    shared_ptr<hittable> right;
+    aabb bbox;
+    int split_axis = 0;  // Axis along which the left child's primitives precede the right's
+    double treelet_cost = 0;  // subtree_cost() of this node, kept by optimize_treelets()
+
+    struct bvh_primitive
+    {
+        // Cached bounds of one object, referring to it by index so that the build moves
+        // plain data rather than reference-counted pointers.
+        size_t index;
+        aabb box;
+        point3 centroid;
+    };
+
+    struct sah_bin
+    {
+        aabb box = aabb::empty;
+        int count = 0;
+    };
+
+    struct build_task
+    {
+        bvh_node* node;
+        size_t start, end;
+    };
+
+    struct build_context
+    {
+        // State shared down one thread's part of a build. At the top of a parallel build,
+        // subtrees over at most task_size primitives are queued in `tasks` instead of being
+        // built; a task_size of zero builds everything in place.
+
+        build_context(const std::vector<shared_ptr<hittable>>& objects, int thread_count, size_t task_size)
+            : objects(objects), thread_count(thread_count), task_size(task_size) {}
+
+        const std::vector<shared_ptr<hittable>>& objects;
+        int thread_count;  // Workers for the work within one large node
+        size_t task_size;
+        const uint64_t* morton_codes = nullptr;  // Sorted codes matching the primitives, for LBVH builds
+        std::vector<build_task> tasks;
+        std::vector<bvh_primitive> scratch;  // Reused by every serial partition
+    };
+
+    struct treelet_pass
+    {
+        // Nodes optimize_treelets() must leave alone, each list sorted: BVHs the caller passed
+        // in as objects, which it must not restructure, and the roots of subtrees that were
+        // optimized already, which it must not descend into again.
+
+        std::vector<const hittable*> foreign;
+        std::vector<const hittable*> finished;
+
+        bool is_foreign(const hittable* node) const
+        {
+            return std::binary_search(foreign.begin(), foreign.end(), node);
+        }
+
+        bool is_finished(const hittable* node) const
+        {
+            return std::binary_search(finished.begin(), finished.end(), node);
+        }
+    };
+
+    // Ranges at least twice this long have their per-node work split across threads in
+    // chunks of this size; queued subtrees cover at least min_task_size primitives.
+    static constexpr size_t parallel_chunk_size = 16384;
+    static constexpr size_t min_task_size = 1024;
+
+    // Builds over at least this many primitives quantize centroids to 63-bit Morton codes.
+    static constexpr size_t morton_63_bit_threshold = size_t(1) << 16;
+
+    bvh_node() {}
+
+    static std::vector<bvh_primitive> cache_primitives(const std::vector<shared_ptr<hittable>>& objects, size_t start,
+                                                       size_t end, int thread_count)
+    {
+        std::vector<bvh_primitive> primitives(end - start);
+        parallel_for_chunks(end - start, parallel_chunk_size, thread_count, [&](size_t begin, size_t stop)
+        {
+            for (size_t i = begin; i < stop; i++)
+            {
+                aabb box = objects[start + i]->bounding_box();
+                primitives[i] = { start + i, box, box.centroid() };
+            }
+        });
+        return primitives;
+    }
+
+    void build(std::vector<bvh_primitive>& primitives, size_t start, size_t end, bvh_build_mode mode,
+               build_context& context)
+    {
+        if (mode == bvh_build_mode::median_split)
+        {
+            build_median(primitives, start, end, context);
+        }
+        else if (mode == bvh_build_mode::binned_sah)
+        {
+            build_sah(primitives, start, end, context);
+        }
+        else
+        {
+            build_lbvh(primitives, start, end, context);
+        }
+    }
+
+    static shared_ptr<hittable> build_child(std::vector<bvh_primitive>& primitives, size_t start, size_t end,
+                                            bvh_build_mode mode, build_context& context)
+    {
+        // Builds the subtree over [start, end) now, or queues it for the parallel phase.
+
+        shared_ptr<bvh_node> child(new bvh_node());
+        if (end - start <= context.task_size)
+        {
+            context.tasks.push_back({ child.get(), start, end });
+        }
+        else
+        {
+            child->build(primitives, start, end, mode, context);
+        }
+        return child;
+    }
+
+    static int node_thread_count(size_t start, size_t end, const build_context& context)
+    {
+        return (end - start >= 2 * parallel_chunk_size ? context.thread_count : 1);
+    }
+
+    void build_median(std::vector<bvh_primitive>& primitives, size_t start, size_t end, build_context& context)
+    {
+        aabb centroid_bounds;
+        scan_bounds(primitives, start, end, node_thread_count(start, end, context), bbox, centroid_bounds);
+
         int axis = bbox.longest_axis();
+        split_axis = axis;
 
-        typedef bool (*pfnComparator)(const shared_ptr<hittable>, const shared_ptr<hittable>);
-        pfnComparator comparator = (axis == 0 ? box_x_compare : (axis == 1 ? box_y_compare : box_z_compare));
+        auto comparator = [axis](const bvh_primitive& a, const bvh_primitive& b)
+        {
+            return a.box.axis_interval(axis).min < b.box.axis_interval(axis).min;
+        };
 
         size_t object_span = end - start;
 
         if (object_span == 1)
         {
-            left = right = objects[start];
+            left = right = context.objects[primitives[start].index];
         }
         else if (object_span == 2)
         {
-            left = objects[start];
-            right = objects[start + 1];
+            bool swapped = comparator(primitives[start + 1], primitives[start]);
+            left = context.objects[primitives[swapped ? start + 1 : start].index];
+            right = context.objects[primitives[swapped ? start : start + 1].index];
         }
         else
         {
-            std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
+            std::sort(primitives.begin() + start, primitives.begin() + end, comparator);
 
             size_t mid = start + object_span / 2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
+            left = build_child(primitives, start, mid, bvh_build_mode::median_split, context);
+            right = build_child(primitives, mid, end, bvh_build_mode::median_split, context);
         }
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    void build_sah(std::vector<bvh_primitive>& primitives, size_t start, size_t end, build_context& context)
     {
-        if (!bbox.hit(r, ray_t))
+        // Bins primitive centroids into sah_bin_count slots along each axis, prices every
+        // split between bins with the surface area heuristic and keeps the cheapest. Each
+        // level is linear in the primitive count, so the whole build is O(n log n).
+
+        int thread_count = node_thread_count(start, end, context);
+
+        aabb centroid_bounds;
+        scan_bounds(primitives, start, end, thread_count, bbox, centroid_bounds);
+        split_axis = centroid_bounds.longest_axis();
+
+        size_t object_span = end - start;
+
+        if (object_span == 1)
         {
-            return false;
+            left = right = context.objects[primitives[start].index];
+            return;
+        }
+        if (object_span == 2)
+        {
+            bool swapped = primitives[start + 1].centroid[split_axis] < primitives[start].centroid[split_axis];
+            left = context.objects[primitives[swapped ? start + 1 : start].index];
+            right = context.objects[primitives[swapped ? start : start + 1].index];
+            return;
         }
 
-        bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+        sah_bin bins[3][sah_bin_count];
+        fill_bins(primitives, start, end, centroid_bounds, bins, thread_count);
 
-        return hit_left || hit_right;
+        double parent_area = bbox.surface_area();
+        double best_cost = infinity;
+        int best_axis = -1;
+        int best_split = 0;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (centroid_bounds.axis_interval(axis).size() <= 0)
+            {
+                continue;
+            }
+
+            // Sweep from the right to record the cost term of every right-hand partition,
+            // then from the left to combine it with the matching left-hand partition.
+            double right_terms[sah_bin_count];
+            aabb right_box = aabb::empty;
+            int right_count = 0;
+            for (int split = sah_bin_count - 1; split > 0; split--)
+            {
+                right_box = aabb(right_box, bins[axis][split].box);
+                right_count += bins[axis][split].count;
+                right_terms[split] = (right_count > 0 ? right_count * right_box.surface_area() : 0.0);
+            }
+
+            aabb left_box = aabb::empty;
+            int left_count = 0;
+            for (int split = 1; split < sah_bin_count; split++)
+            {
+                left_box = aabb(left_box, bins[axis][split - 1].box);
+                left_count += bins[axis][split - 1].count;
+                if (left_count == 0 || left_count == int(object_span))
+                {
+                    continue;
+                }
+
+                double left_term = left_count * left_box.surface_area();
+                double cost = traversal_cost + intersection_cost * (left_term + right_terms[split]) / parent_area;
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = split;
+                }
+            }
+        }
+
+        double leaf_cost = intersection_cost * object_span;
+        if (object_span <= size_t(max_leaf_size) && leaf_cost <= best_cost)
+        {
+            // Testing the primitives directly beats splitting them further.
+            auto leaf = make_shared<hittable_list>();
+            for (size_t i = start; i < end; i++)
+            {
+                leaf->add(context.objects[primitives[i].index]);
+            }
+            left = right = leaf;
+            return;
+        }
+
+        size_t mid = start + object_span / 2;
+        if (best_axis >= 0)
+        {
+            split_axis = best_axis;
+            const interval& extent = centroid_bounds.axis_interval(best_axis);
+            mid = partition_primitives(primitives, start, end, thread_count, context.scratch,
+                [&](const bvh_primitive& p) { return bin_index(p.centroid[best_axis], extent) < best_split; });
+        }
+
+        // All centroids coincide, so no plane separates them; any even split is as good.
+        if (mid == start || mid == end)
+        {
+            mid = start + object_span / 2;
+        }
+
+        left = build_child(primitives, start, mid, bvh_build_mode::binned_sah, context);
+        right = build_child(primitives, mid, end, bvh_build_mode::binned_sah, context);
     }
 
-    aabb bounding_box() const override { return bbox; }
+    void build_lbvh(std::vector<bvh_primitive>& primitives, size_t start, size_t end, build_context& context)
+    {
+        // The primitives arrive sorted along a Morton curve, so the highest bit in which the
+        // range's first and last codes differ is 0 for a prefix of the range and 1 for the
+        // rest: the two halves of the octree cell the range spans. Splitting there needs one
+        // binary search and no sorting or binning, and that bit names the split axis. Single
+        // primitives become children directly, with no node around them.
 
-private:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
-    aabb bbox;
+        const uint64_t* codes = context.morton_codes;
+        size_t object_span = end - start;
+
+        if (object_span == 1)
+        {
+            left = right = context.objects[primitives[start].index];
+            bbox = primitives[start].box;
+            return;
+        }
+
+        uint64_t differing = codes[start] ^ codes[end - 1];
+        size_t mid = start + object_span / 2;
+        if (differing != 0)
+        {
+            int bit = highest_bit(differing);
+            uint64_t mask = uint64_t(1) << bit;
+            mid = size_t(std::partition_point(codes + start, codes + end,
+                                              [mask](uint64_t code) { return (code & mask) == 0; }) - codes);
+            split_axis = 2 - bit % 3;
+        }
+
+        auto child = [&](size_t first, size_t last)
+        {
+            return (last - first == 1 ? context.objects[primitives[first].index]
+                                      : build_child(primitives, first, last, bvh_build_mode::lbvh, context));
+        };
+        left = child(start, mid);
+        right = child(mid, end);
+
+        if (context.task_size > 0)
+        {
+            // Children may still be queued, so take the bounds from the primitives.
+            aabb centroid_bounds;
+            scan_bounds(primitives, start, end, node_thread_count(start, end, context), bbox, centroid_bounds);
+        }
+        else
+        {
+            auto child_box = [&](const shared_ptr<hittable>& child, size_t first, size_t last)
+            {
+                return (last - first == 1 ? primitives[first].box : static_cast<const bvh_node*>(child.get())->bbox);
+            };
+            bbox = aabb(child_box(left, start, mid), child_box(right, mid, end));
+        }
+
+        // Identical codes leave nothing to split on; the middle is as good as any position.
+        if (differing == 0)
+        {
+            split_axis = bbox.longest_axis();
+        }
+    }
+
+    static std::vector<uint64_t> sort_by_morton_code(std::vector<bvh_primitive>& primitives, int thread_count)
+    {
+        // Quantizes every centroid to a grid over the centroid bounds and interleaves the
+        // cell coordinates' bits, x highest, into a Morton code: 10 bits per axis (30-bit
+        // codes) for scenes small enough that few primitives share a cell, 21 per axis (63
+        // bits) above that. The primitives are then sorted by code and the sorted codes
+        // returned.
+
+        size_t count = primitives.size();
+        aabb bounds, centroid_bounds;
+        scan_bounds(primitives, 0, count, thread_count, bounds, centroid_bounds);
+
+        int bits_per_axis = (count < morton_63_bit_threshold ? 10 : 21);
+        uint64_t max_cell = (uint64_t(1) << bits_per_axis) - 1;
+        double scale = double(max_cell + 1);
+
+        std::vector<uint64_t> codes(count);
+        std::vector<uint32_t> order(count);
+        parallel_for_chunks(count, parallel_chunk_size, thread_count, [&](size_t begin, size_t stop)
+        {
+            for (size_t i = begin; i < stop; i++)
+            {
+                uint64_t code = 0;
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    const interval& extent = centroid_bounds.axis_interval(axis);
+                    double offset = (extent.size() > 0 ? (primitives[i].centroid[axis] - extent.min) / extent.size() : 0.0);
+                    uint64_t cell = std::min(uint64_t(offset * scale), max_cell);
+                    code |= spread_bits(cell) << (2 - axis);
+                }
+                codes[i] = code;
+                order[i] = uint32_t(i);
+            }
+        });
+
+        radix_sort(codes, order, 3 * bits_per_axis, thread_count);
+
+        std::vector<bvh_primitive> sorted(count);
+        parallel_for_chunks(count, parallel_chunk_size, thread_count, [&](size_t begin, size_t stop)
+        {
+            for (size_t i = begin; i < stop; i++)
+            {
+                sorted[i] = primitives[order[i]];
+            }
+        });
+        primitives.swap(sorted);
+
+        return codes;
+    }
 
-    static bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index)
+    static uint64_t spread_bits(uint64_t x)
     {
-        interval a_axis_interval = a->bounding_box().axis_interval(axis_index);
-        interval b_axis_interval = b->bounding_box().axis_interval(axis_index);
-        return (a_axis_interval.min < b_axis_interval.min);
+        // Moves bit i of a 21-bit value to bit 3i.
+        x &= 0x1fffff;
+        x = (x | x << 32) & 0x1f00000000ffff;
+        x = (x | x << 16) & 0x1f0000ff0000ff;
+        x = (x | x << 8) & 0x100f00f00f00f00f;
+        x = (x | x << 4) & 0x10c30c30c30c30c3;
+        x = (x | x << 2) & 0x1249249249249249;
+        return x;
     }
 
-    static bool box_x_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+    static int highest_bit(uint64_t x)
     {
-        return box_compare(a, b, 0);
+        int bit = 0;
+        while (x >>= 1)
+        {
+            bit++;
+        }
+        return bit;
     }
 
-    static bool box_y_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+    static void radix_sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, int key_bits, int thread_count)
     {
-        return box_compare(a, b, 1);
+        // Stable LSD radix sort of keys, and values alongside them, by the low key_bits bits,
+        // a byte per pass. Each pass counts the digits of every chunk, turns the counts into
+        // output offsets with a prefix sum over (digit, chunk), and scatters the chunks in
+        // parallel, so the result is the same for every thread count.
+
+        size_t count = keys.size();
+        size_t chunk_count = (count + parallel_chunk_size - 1) / parallel_chunk_size;
+        std::vector<size_t> offsets(chunk_count * 256);
+        std::vector<uint64_t> sorted_keys(count);
+        std::vector<uint32_t> sorted_values(count);
+
+        for (int shift = 0; shift < key_bits; shift += 8)
+        {
+            parallel_for_chunks(count, parallel_chunk_size, thread_count, [&](size_t begin, size_t stop)
+            {
+                size_t* histogram = &offsets[begin / parallel_chunk_size * 256];
+                std::fill(histogram, histogram + 256, size_t(0));
+                for (size_t i = begin; i < stop; i++)
+                {
+                    histogram[(keys[i] >> shift) & 255]++;
+                }
+            });
+
+            size_t total = 0;
+            for (int digit = 0; digit < 256; digit++)
+            {
+                for (size_t chunk = 0; chunk < chunk_count; chunk++)
+                {
+                    size_t digit_count = offsets[chunk * 256 + digit];
+                    offsets[chunk * 256 + digit] = total;
+                    total += digit_count;
+                }
+            }
+
+            parallel_for_chunks(count, parallel_chunk_size, thread_count, [&](size_t begin, size_t stop)
+            {
+                size_t* next = &offsets[begin / parallel_chunk_size * 256];
+                for (size_t i = begin; i < stop; i++)
+                {
+                    size_t out = next[(keys[i] >> shift) & 255]++;
+                    sorted_keys[out] = keys[i];
+                    sorted_values[out] = values[i];
+                }
+            });
+
+            keys.swap(sorted_keys);
+            values.swap(sorted_values);
+        }
     }
 
-    static bool box_z_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b)
+    struct treelet
+    {
+        // One treelet being restructured: its leaves and the interior nodes opened to reach
+        // them, and for every subset of the leaves the box, the lowest cost of a subtree over
+        // it, and the split of the subset that achieves that cost. The singleton subset of
+        // leaf i is 1 << i.
+
+        shared_ptr<hittable> leaves[treelet_size];
+        bvh_node* leaf_nodes[treelet_size];  // The leaf if the pass may open it, else null
+        shared_ptr<hittable> opened[treelet_size - 2];
+        int leaf_count = 0;
+        int opened_count = 0;
+        int next_opened = 0;
+
+        aabb boxes[1 << treelet_size];
+        double costs[1 << treelet_size];
+        double tests[1 << treelet_size];  // Primitive tests of a single leaf that is not a node, else 0
+        int splits[1 << treelet_size];
+    };
+
+    static bvh_node* treelet_node(const shared_ptr<hittable>& child, const treelet_pass& pass)
     {
-        return box_compare(a, b, 2);
+        // The child as a node of this build, which the treelet pass may restructure.
+        bvh_node* node = dynamic_cast<bvh_node*>(child.get());
+        return (node != nullptr && !pass.is_foreign(node) ? node : nullptr);
+    }
+
+    void optimize_treelets(const treelet_pass& pass, treelet& t)
+    {
+        // Karras and Aila's treelet restructuring, bottom-up. Each node grows a treelet of up
+        // to treelet_size leaves below it and rewires the treelet's interior nodes into the
+        // topology with the lowest subtree_cost(), found by dynamic programming over subsets
+        // of the leaves. Subtrees below are already optimal in this sense, so their cached
+        // costs stand in for them. `t` is scratch space shared by the whole pass.
+
+        bvh_node* left_node = treelet_node(left, pass);
+        if (left_node != nullptr && !pass.is_finished(left_node))
+        {
+            left_node->optimize_treelets(pass, t);
+        }
+
+        if (right == left)
+        {
+            double area = bbox.surface_area();
+            treelet_cost = traversal_cost * area + (left_node != nullptr ? left_node->treelet_cost : child_cost(left, area));
+            return;
+        }
+
+        bvh_node* right_node = treelet_node(right, pass);
+        if (right_node != nullptr && !pass.is_finished(right_node))
+        {
+            right_node->optimize_treelets(pass, t);
+        }
+
+        // The treelet takes over the child pointers; assign_treelet() hands every one back.
+        t.leaf_count = 2;
+        t.opened_count = 0;
+        t.next_opened = 0;
+        set_treelet_leaf(t, 0, std::move(left), left_node);
+        set_treelet_leaf(t, 1, std::move(right), right_node);
+
+        // Open the interior leaf with the largest surface area until the treelet is full.
+        while (t.leaf_count < treelet_size)
+        {
+            int largest = -1;
+            double largest_area = -1;
+            for (int i = 0; i < t.leaf_count; i++)
+            {
+                const bvh_node* node = t.leaf_nodes[i];
+                if (node != nullptr && node->right != node->left && node->bbox.surface_area() > largest_area)
+                {
+                    largest = i;
+                    largest_area = node->bbox.surface_area();
+                }
+            }
+
+            if (largest < 0)
+            {
+                break;
+            }
+
+            bvh_node* node = t.leaf_nodes[largest];
+            t.opened[t.opened_count++] = std::move(t.leaves[largest]);
+            set_treelet_leaf(t, largest, std::move(node->left), treelet_node(node->left, pass));
+            set_treelet_leaf(t, t.leaf_count++, std::move(node->right), treelet_node(node->right, pass));
+        }
+
+        int full_set = (1 << t.leaf_count) - 1;
+        for (int subset = 1; subset <= full_set; subset++)
+        {
+            int lowest = subset & -subset;
+            if (subset == lowest)
+            {
+                continue;
+            }
+
+            t.boxes[subset] = aabb(t.boxes[subset ^ lowest], t.boxes[lowest]);
+            double area = t.boxes[subset].surface_area();
+            double test_cost = intersection_cost * area;
+
+            // Every split into two non-empty parts, each counted once by keeping the lowest
+            // leaf in the first part. A part that is a single primitive is tested whenever
+            // this node is entered; any other part carries its own cost.
+            int rest = subset ^ lowest;
+            double best_cost = infinity;
+            int best_split = lowest;
+            for (int others = (rest - 1) & rest; ; others = (others - 1) & rest)
+            {
+                int part = others | lowest;
+                double cost = t.costs[part] + t.costs[subset ^ part] + test_cost * (t.tests[part] + t.tests[subset ^ part]);
+                best_split = (cost < best_cost ? part : best_split);
+                best_cost = (cost < best_cost ? cost : best_cost);
+                if (others == 0)
+                {
+                    break;
+                }
+            }
+
+            t.costs[subset] = traversal_cost * area + best_cost;
+            t.tests[subset] = 0;
+            t.splits[subset] = best_split;
+        }
+
+        assign_treelet(full_set, t);
+    }
+
+    static void set_treelet_leaf(treelet& t, int index, shared_ptr<hittable>&& leaf, bvh_node* node)
+    {
+        // Places a leaf in slot `index` and fills in its singleton subset.
+
+        int subset = 1 << index;
+        t.leaf_nodes[index] = node;
+        t.tests[subset] = 0;
+
+        if (node != nullptr)
+        {
+            t.boxes[subset] = node->bbox;
+            t.costs[subset] = node->treelet_cost;
+        }
+        else if (const bvh_node* nested = dynamic_cast<const bvh_node*>(leaf.get()))
+        {
+            t.boxes[subset] = nested->bbox;
+            t.costs[subset] = nested->subtree_cost();
+        }
+        else
+        {
+            const hittable_list* list = dynamic_cast<const hittable_list*>(leaf.get());
+            t.boxes[subset] = leaf->bounding_box();
+            t.costs[subset] = 0;
+            t.tests[subset] = double(list != nullptr ? list->objects.size() : 1);
+        }
+
+        t.leaves[index] = std::move(leaf);
+    }
+
+    void assign_treelet(int subset, treelet& t)
+    {
+        // Makes this node the root of the best subtree over `subset`, taking interior nodes
+        // from the ones the treelet opened.
+
+        int part = t.splits[subset];
+        left = treelet_child(part, t);
+        right = treelet_child(subset ^ part, t);
+        bbox = t.boxes[subset];
+        treelet_cost = t.costs[subset];
+
+        // Split along the axis on which the children's centers lie farthest apart, with the
+        // lower child on the left.
+        point3 left_center = t.boxes[part].centroid();
+        point3 right_center = t.boxes[subset ^ part].centroid();
+        split_axis = 0;
+        for (int axis = 1; axis < 3; axis++)
+        {
+            if (std::fabs(right_center[axis] - left_center[axis]) >
+                std::fabs(right_center[split_axis] - left_center[split_axis]))
+            {
+                split_axis = axis;
+            }
+        }
+        if (right_center[split_axis] < left_center[split_axis])
+        {
+            std::swap(left, right);
+        }
+    }
+
+    static shared_ptr<hittable> treelet_child(int subset, treelet& t)
+    {
+        if ((subset & (subset - 1)) == 0)
+        {
+            return std::move(t.leaves[lowest_index(subset)]);
+        }
+
+        shared_ptr<hittable> node = std::move(t.opened[t.next_opened++]);
+        static_cast<bvh_node*>(node.get())->assign_treelet(subset, t);
+        return node;
+    }
+
+    static int lowest_index(int subset)
+    {
+        int index = 0;
+        while (((subset >> index) & 1) == 0)
+        {
+            index++;
+        }
+        return index;
+    }
+
+    static void scan_bounds(const std::vector<bvh_primitive>& primitives, size_t start, size_t end, int thread_count,
+                            aabb& bounds, aabb& centroid_bounds)
+    {
+        // Unions the boxes and centroids of [start, end). With several threads each chunk
+        // is unioned separately and the chunks are then combined; box unions are exact, so
+        // the result is the same either way.
+
+        bounds = aabb::empty;
+        centroid_bounds = aabb::empty;
+
+        if (thread_count <= 1)
+        {
+            for (size_t i = start; i < end; i++)
+            {
+                bounds = aabb(bounds, primitives[i].box);
+                centroid_bounds = aabb(centroid_bounds, aabb(primitives[i].centroid, primitives[i].centroid));
+            }
+            return;
+        }
+
+        size_t chunk_count = (end - start + parallel_chunk_size - 1) / parallel_chunk_size;
+        std::vector<aabb> chunk_bounds(chunk_count, aabb::empty);
+        std::vector<aabb> chunk_centroids(chunk_count, aabb::empty);
+
+        parallel_for_chunks(end - start, parallel_chunk_size, thread_count, [&](size_t begin, size_t stop)
+        {
+            size_t chunk = begin / parallel_chunk_size;
+            for (size_t i = start + begin; i < start + stop; i++)
+            {
+                chunk_bounds[chunk] = aabb(chunk_bounds[chunk], primitives[i].box);
+                chunk_centroids[chunk] = aabb(chunk_centroids[chunk], aabb(primitives[i].centroid, primitives[i].centroid));
+            }
+        });
+
+        for (size_t chunk = 0; chunk < chunk_count; chunk++)
+        {
+            bounds = aabb(bounds, chunk_bounds[chunk]);
+            centroid_bounds = aabb(centroid_bounds, chunk_centroids[chunk]);
+        }
+    }
+
+    static void fill_bins(const std::vector<bvh_primitive>& primitives, size_t start, size_t end,
+                          const aabb& centroid_bounds, sah_bin (&bins)[3][sah_bin_count], int thread_count)
+    {
+        // Bins [start, end) along every axis the centroids spread over, in one pass. With
+        // several threads each chunk fills its own bins and the chunks are then merged.
+
+        auto bin_range = [&](size_t first, size_t last, sah_bin* axis_bins)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                for (int axis = 0; axis < 3; axis++)
+                {
+                    const interval& extent = centroid_bounds.axis_interval(axis);
+                    if (extent.size() <= 0)
+                    {
+                        continue;
+                    }
+
+                    sah_bin& bin = axis_bins[axis * sah_bin_count + bin_index(primitives[i].centroid[axis], extent)];
+                    bin.box = aabb(bin.box, primitives[i].box);
+                    bin.count++;
+                }
+            }
+        };
+
+        if (thread_count <= 1)
+        {
+            bin_range(start, end, &bins[0][0]);
+            return;
+        }
+
+        size_t chunk_count = (end - start + parallel_chunk_size - 1) / parallel_chunk_size;
+        std::vector<sah_bin> chunk_bins(chunk_count * 3 * sah_bin_count);
+
+        parallel_for_chunks(end - start, parallel_chunk_size, thread_count, [&](size_t begin, size_t stop)
+        {
+            size_t chunk = begin / parallel_chunk_size;
+            bin_range(start + begin, start + stop, &chunk_bins[chunk * 3 * sah_bin_count]);
+        });
+
+        for (size_t chunk = 0; chunk < chunk_count; chunk++)
+        {
+            for (int slot = 0; slot < 3 * sah_bin_count; slot++)
+            {
+                const sah_bin& from = chunk_bins[chunk * 3 * sah_bin_count + slot];
+                sah_bin& to = bins[slot / sah_bin_count][slot % sah_bin_count];
+                to.box = aabb(to.box, from.box);
+                to.count += from.count;
+            }
+        }
+    }
+
+    template<typename Predicate>
+    static size_t partition_primitives(std::vector<bvh_primitive>& primitives, size_t start, size_t end,
+                                       int thread_count, std::vector<bvh_primitive>& scratch,
+                                       const Predicate& goes_left)
+    {
+        // Stable partition of [start, end), returning the first index on the right. Keeping
+        // the order makes the tree independent of the thread count. A single thread compacts
+        // the left-hand primitives in place and parks the others in `scratch`. With several,
+        // each chunk counts its left-hand primitives, prefix sums turn the counts into
+        // output offsets, and the chunks then scatter in parallel.
+
+        if (thread_count <= 1)
+        {
+            scratch.clear();
+            size_t next_left = start;
+            for (size_t i = start; i < end; i++)
+            {
+                if (goes_left(primitives[i]))
+                {
+                    primitives[next_left++] = primitives[i];
+                }
+                else
+                {
+                    scratch.push_back(primitives[i]);
+                }
+            }
+            std::copy(scratch.begin(), scratch.end(), primitives.begin() + next_left);
+            return next_left;
+        }
+
+        size_t span = end - start;
+        size_t chunk_count = (span + parallel_chunk_size - 1) / parallel_chunk_size;
+        std::vector<size_t> left_offsets(chunk_count + 1, 0);
+        std::vector<size_t> right_offsets(chunk_count + 1, 0);
+
+        parallel_for_chunks(span, parallel_chunk_size, thread_count, [&](size_t begin, size_t stop)
+        {
+            size_t left_count = 0;
+            for (size_t i = start + begin; i < start + stop; i++)
+            {
+                left_count += (goes_left(primitives[i]) ? 1 : 0);
+            }
+            left_offsets[begin / parallel_chunk_size + 1] = left_count;
+            right_offsets[begin / parallel_chunk_size + 1] = (stop - begin) - left_count;
+        });
+
+        for (size_t chunk = 0; chunk < chunk_count; chunk++)
+        {
+            left_offsets[chunk + 1] += left_offsets[chunk];
+            right_offsets[chunk + 1] += right_offsets[chunk];
+        }
+
+        size_t left_total = left_offsets[chunk_count];
+        std::vector<bvh_primitive> partitioned(span);
+
+        parallel_for_chunks(span, parallel_chunk_size, thread_count, [&](size_t begin, size_t stop)
+        {
+            size_t next_left = left_offsets[begin / parallel_chunk_size];
+            size_t next_right = left_total + right_offsets[begin / parallel_chunk_size];
+            for (size_t i = start + begin; i < start + stop; i++)
+            {
+                size_t out = (goes_left(primitives[i]) ? next_left++ : next_right++);
+                partitioned[out] = primitives[i];
+            }
+        });
+
+        parallel_for_chunks(span, parallel_chunk_size, thread_count, [&](size_t begin, size_t stop)
+        {
+            for (size_t i = begin; i < stop; i++)
+            {
+                primitives[start + i] = partitioned[i];
+            }
+        });
+
+        return start + left_total;
+    }
+
+    void flatten_node(linear_bvh& flat, int depth) const
+    {
+        const bvh_node* left_node = dynamic_cast<const bvh_node*>(left.get());
+        const bvh_node* right_node = dynamic_cast<const bvh_node*>(right.get());
+
+        if ((left_node == nullptr && right_node == nullptr) || depth >= linear_bvh::max_depth - 1)
+        {
+            std::vector<shared_ptr<hittable>> leaf_objects;
+            collect_leaf_objects(leaf_objects);
+            flat.add_leaf(bbox, leaf_objects);
+            return;
+        }
+
+        uint32_t index = flat.add_interior(bbox, split_axis);
+        flatten_child(flat, left, left_node, depth + 1);
+        flat.set_second_child(index, uint32_t(flat.node_count()));
+        flatten_child(flat, right, right_node, depth + 1);
+    }
+
+    void flatten_motion_node(motion_bvh& flat, int depth, aabb& box_open, aabb& box_close) const
+    {
+        const bvh_node* left_node = dynamic_cast<const bvh_node*>(left.get());
+        const bvh_node* right_node = dynamic_cast<const bvh_node*>(right.get());
+
+        if ((left_node == nullptr && right_node == nullptr) || depth >= motion_bvh::max_depth - 1)
+        {
+            std::vector<shared_ptr<hittable>> leaf_objects;
+            collect_leaf_objects(leaf_objects);
+            add_motion_leaf(flat, leaf_objects, box_open, box_close);
+            return;
+        }
+
+        uint32_t index = flat.add_interior(split_axis);
+        aabb right_open, right_close;
+        flatten_motion_child(flat, left, left_node, depth + 1, box_open, box_close);
+        flat.set_second_child(index, uint32_t(flat.node_count()));
+        flatten_motion_child(flat, right, right_node, depth + 1, right_open, right_close);
+
+        box_open = aabb(box_open, right_open);
+        box_close = aabb(box_close, right_close);
+        flat.set_bounds(index, box_open, box_close);
+    }
+
+    static void flatten_motion_child(motion_bvh& flat, const shared_ptr<hittable>& child, const bvh_node* node,
+                                     int depth, aabb& box_open, aabb& box_close)
+    {
+        if (node != nullptr)
+        {
+            node->flatten_motion_node(flat, depth, box_open, box_close);
+            return;
+        }
+
+        std::vector<shared_ptr<hittable>> leaf_objects;
+        append_leaf_objects(leaf_objects, child);
+        add_motion_leaf(flat, leaf_objects, box_open, box_close);
+    }
+
+    static void add_motion_leaf(motion_bvh& flat, const std::vector<shared_ptr<hittable>>& leaf_objects,
+                                aabb& box_open, aabb& box_close)
+    {
+        box_open = aabb();
+        box_close = aabb();
+        for (const shared_ptr<hittable>& object : leaf_objects)
+        {
+            box_open = aabb(box_open, object->bounding_box_at(0));
+            box_close = aabb(box_close, object->bounding_box_at(1));
+        }
+        flat.set_bounds(flat.add_leaf(leaf_objects), box_open, box_close);
+    }
+
+    template<int Width>
+    uint32_t collapse_node(wide_bvh<Width>& wide, int depth) const
+    {
+        std::vector<const shared_ptr<hittable>*> children = { &left };
+        if (right != left)
+        {
+            children.push_back(&right);
+        }
+
+        // Open the interior child with the largest surface area while its children fit.
+        while (true)
+        {
+            int largest = -1;
+            double largest_area = -1;
+            for (size_t i = 0; i < children.size(); i++)
+            {
+                const bvh_node* node = dynamic_cast<const bvh_node*>(children[i]->get());
+                if (node == nullptr || children.size() + (node->right == node->left ? 0 : 1) > size_t(Width))
+                {
+                    continue;
+                }
+
+                double area = node->bbox.surface_area();
+                if (area > largest_area)
+                {
+                    largest = int(i);
+                    largest_area = area;
+                }
+            }
+
+            if (largest < 0)
+            {
+                break;
+            }
+
+            const bvh_node* opened = static_cast<const bvh_node*>(children[largest]->get());
+            children[largest] = &opened->left;
+            if (opened->right != opened->left)
+            {
+                children.push_back(&opened->right);
+            }
+        }
+
+        uint32_t index = wide.add_node(bbox);
+        for (size_t slot = 0; slot < children.size(); slot++)
+        {
+            const shared_ptr<hittable>& child = *children[slot];
+            const bvh_node* node = dynamic_cast<const bvh_node*>(child.get());
+
+            if (node != nullptr && depth < wide_bvh<Width>::max_depth - 1)
+            {
+                uint32_t child_index = node->collapse_node(wide, depth + 1);
+                wide.set_child_node(index, int(slot), node->bbox, child_index);
+                continue;
+            }
+
+            std::vector<shared_ptr<hittable>> leaf_objects;
+            if (node != nullptr)
+            {
+                node->collect_leaf_objects(leaf_objects);
+            }
+            else
+            {
+                append_leaf_objects(leaf_objects, child);
+            }
+            wide.set_child_leaf(index, int(slot), child->bounding_box(), leaf_objects);
+        }
+
+        return index;
+    }
+
+    template<typename layout>
+    static void report_layout(const char* name, const layout& tree, const std::vector<ray>& rays)
+    {
+        bvh_traversal_stats stats;
+        for (const ray& r : rays)
+        {
+            tree.count_traversal(r, interval(0, infinity), stats);
+        }
+
+        double per_ray = (stats.rays > 0 ? 1.0 / double(stats.rays) : 0.0);
+        std::clog << name << ": " << tree.node_count() << " nodes x " << tree.node_bytes() << " B = "
+                  << std::fixed << std::setprecision(1) << (tree.node_count() * tree.node_bytes()) / 1024.0 << " KiB; per ray "
+                  << stats.node_visits * per_ray << " node visits, " << stats.box_tests * per_ray << " box tests, "
+                  << stats.primitive_tests * per_ray << " primitive tests\n" << std::defaultfloat;
+    }
+
+    static void flatten_child(linear_bvh& flat, const shared_ptr<hittable>& child, const bvh_node* node, int depth)
+    {
+        if (node != nullptr)
+        {
+            node->flatten_node(flat, depth);
+            return;
+        }
+
+        std::vector<shared_ptr<hittable>> leaf_objects;
+        append_leaf_objects(leaf_objects, child);
+        flat.add_leaf(child->bounding_box(), leaf_objects);
+    }
+
+    void collect_leaf_objects(std::vector<shared_ptr<hittable>>& leaf_objects) const
+    {
+        // Gathers every primitive below this node, for nodes flattened into a single leaf.
+
+        const shared_ptr<hittable>* children[2] = { &left, &right };
+        for (int i = 0; i < (right == left ? 1 : 2); i++)
+        {
+            if (const bvh_node* node = dynamic_cast<const bvh_node*>(children[i]->get()))
+            {
+                node->collect_leaf_objects(leaf_objects);
+            }
+            else
+            {
+                append_leaf_objects(leaf_objects, *children[i]);
+            }
+        }
+    }
+
+    static void append_leaf_objects(std::vector<shared_ptr<hittable>>& leaf_objects, const shared_ptr<hittable>& child)
+    {
+        // A plain list is just a closest-hit loop over its objects, so its objects can be
+        // placed in the leaf's primitive range directly.
+
+        const hittable_list* list = dynamic_cast<const hittable_list*>(child.get());
+        if (list != nullptr && leaf_objects.size() + list->objects.size() <= UINT16_MAX)
+        {
+            leaf_objects.insert(leaf_objects.end(), list->objects.begin(), list->objects.end());
+        }
+        else
+        {
+            leaf_objects.push_back(child);
+        }
+    }
+
+    static int bin_index(double centroid, const interval& extent)
+    {
+        int index = int(sah_bin_count * (centroid - extent.min) / extent.size());
+        return (index < 0 ? 0 : (index >= sah_bin_count ? sah_bin_count - 1 : index));
+    }
+
+    double subtree_cost() const
+    {
+        // Surface-area-weighted cost of this subtree, before normalizing by the root area.
+
+        double area = bbox.surface_area();
+        double cost = traversal_cost * area;
+
+        cost += child_cost(left, area);
+        if (right != left)
+        {
+            cost += child_cost(right, area);
+        }
+
+        return cost;
+    }
+
+    static double child_cost(const shared_ptr<hittable>& child, double parent_area)
+    {
+        // Nested nodes carry their own weighted cost. Anything else is tested every time the
+        // parent is entered; a plain list (an SAH leaf, or a box's sides) costs one test per
+        // object it holds.
+
+        if (const bvh_node* node = dynamic_cast<const bvh_node*>(child.get()))
+        {
+            return node->subtree_cost();
+        }
+
+        size_t count = 1;
+        if (const hittable_list* list = dynamic_cast<const hittable_list*>(child.get()))
+        {
+            count = list->objects.size();
+        }
+
+        return intersection_cost * count * parent_area;
     }
 };
 
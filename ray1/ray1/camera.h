@@ -1,9 +1,19 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include "checkpoint.h"
+#include "framebuffer.h"
 #include "hittable.h"
+#include "image_writer.h"
+#include "parallel.h"
 #include "pdf.h"
 #include "material.h"
+#include "wavefront.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
 
 class camera
 {
@@ -12,6 +22,8 @@ public:
     int    image_width = 100;  // Rendered image width in pixel count
     int    samples_per_pixel = 10;   // Count of random samples for each pixel
     int    max_depth = 10;   // Maximum number of ray bounces into scene
+    bool   russian_roulette = true;  // Randomly end low-throughput paths instead of relying on max_depth
+    int    rr_min_depth = 3;         // Bounces every path takes before Russian roulette may end it
     color  background;               // Scene background color
 
     double vfov = 90;  // Vertical view angle (field of view)
@@ -22,30 +34,73 @@ public:
     double defocus_angle = 0;  // Variation angle of rays through each pixel
     double focus_dist = 10;    // Distance from camera lookfrom point to plane of perfect focus
 
+    bool   next_event_estimation = false;  // Light diffuse hits with explicit shadow rays
+
+    bool   ray_packets = false;      // Trace camera rays for blocks of neighbouring pixels as packets
+    bool   wavefront = false;        // Trace breadth-first in stages over large ray queues
+    int    wavefront_paths = 1 << 14;  // Paths in flight per wavefront batch
+
+    bool   adaptive_sampling = false;   // Stop sampling each pixel once its estimate converges
+    int    adaptive_min_spp = 16;       // Samples every pixel takes before it may stop
+    int    adaptive_max_spp = 0;        // Per-pixel sample cap (0 = samples_per_pixel)
+    double adaptive_threshold = 0.25;   // Target standard error relative to the pixel's luminance
+
+    bool   progressive = false;          // Render in passes into an accumulation buffer
+    int    pass_spp = 16;                // Samples per pixel each pass adds (rounded down to a square)
+    std::string checkpoint_file;         // Progressive checkpoint to resume from and save to (empty = none)
+    double checkpoint_interval = 60;     // Minimum seconds between checkpoint saves
+    double time_budget = 0;              // Wall-clock seconds to fit a progressive render into (0 = none)
+
+    int    thread_count = 0;   // Render worker threads (0 = one per hardware thread, 1 = serial)
+    int    tile_size = 16;     // Edge length in pixels of the square tiles handed to workers
+
+    image_format output_format = image_format::ppm_ascii;  // Encoding of the finished image
+    std::string  output_file;    // Image file to write (empty = standard output)
+
     void render(const hittable& world, const hittable& lights)
     {
         initialize();
 
-        std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+        framebuffer image(image_width, image_height);
 
-        for (int j = 0; j < image_height; ++j)
+        if (progressive || time_budget > 0)
         {
-            std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-            for (int i = 0; i < image_width; ++i)
+            render_progressive(world, lights, image);
+        }
+        else if (wavefront)
+        {
+            render_wavefront(world, lights, image);
+        }
+        else
+        {
+            std::atomic<long long> samples_taken(0);
+
+            for_each_tile("", [&](int tile, int x0, int y0, int x1, int y1)
             {
-                color pixel_color(0, 0, 0);
-                for (int s_j = 0; s_j < sqrt_spp; s_j++)
-                {
-                    for (int s_i = 0; s_i < sqrt_spp; s_i++)
-                    {
-                        ray r = get_ray(i, j, s_i, s_j);
-                        pixel_color += ray_color(r, max_depth, world, lights);
-                    }
-                }
-                write_color(std::cout, pixel_samples_scale * pixel_color);
+                samples_taken += render_tile(x0, y0, x1, y1, world, lights, image);
+            });
+
+            if (adaptive_sampling)
+            {
+                std::clog << "\rAverage samples per pixel: "
+                          << double(samples_taken) / (double(image_width) * image_height) << '\n';
             }
         }
 
+        // The framebuffer holds linear radiance; it is quantized, if at all, only here.
+        if (output_file.empty())
+        {
+            if (output_format != image_format::ppm_ascii)
+            {
+                set_binary_stdout();
+            }
+            write_image(std::cout, image, output_format);
+        }
+        else
+        {
+            write_image(output_file, image, output_format);
+        }
+
         std::clog << "\rDone.                 \n";
     }
 
@@ -102,86 +157,907 @@ private:
         defocus_disk_v = v * defocus_radius;
     }
 
-    ray get_ray(int i, int j, int s_i, int s_j) const
+    int tiles_across() const { return (image_width + tile_size - 1) / tile_size; }
+    int tile_count() const { return tiles_across() * ((image_height + tile_size - 1) / tile_size); }
+
+    template<typename Func>
+    void for_each_tile(const std::string& status, const std::vector<int>& tiles, const Func& render_tile_function) const
+    {
+        // Hands the given tiles to the worker threads, calling
+        // render_tile_function(tile, x0, y0, x1, y1) for the pixels [x0,x1) x [y0,y1) of each.
+
+        int tiles_x = tiles_across();
+        int task_count = int(tiles.size());
+
+        std::atomic<int> tiles_done(0);
+        std::mutex progress_mutex;
+
+        parallel_for(task_count, thread_count, [&](int task, int worker)
+        {
+            int tile = tiles[task];
+            int x0 = (tile % tiles_x) * tile_size;
+            int y0 = (tile / tiles_x) * tile_size;
+            render_tile_function(tile, x0, y0, std::min(x0 + tile_size, image_width), std::min(y0 + tile_size, image_height));
+
+            int done = ++tiles_done;
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            std::clog << "\r" << status << "Tiles remaining: " << (task_count - done) << ' ' << std::flush;
+        });
+    }
+
+    template<typename Func>
+    void for_each_tile(const std::string& status, const Func& render_tile_function) const
+    {
+        std::vector<int> tiles(tile_count());
+        for (int tile = 0; tile < int(tiles.size()); tile++)
+        {
+            tiles[tile] = tile;
+        }
+
+        for_each_tile(status, tiles, render_tile_function);
+    }
+
+    void render_progressive(const hittable& world, const hittable& lights, framebuffer& image) const
+    {
+        // Renders samples_per_pixel samples as a series of passes into an accumulation buffer,
+        // saving it to checkpoint_file at most every checkpoint_interval seconds and after the
+        // last pass. A checkpoint left by an earlier run of the same scene is picked up and
+        // only the missing passes are rendered, so raising samples_per_pixel and rerunning
+        // adds samples to a finished render as well.
+        //
+        // With a time budget, a pilot pass of one sample per pixel first measures what each
+        // tile costs. Passes are then added while the predicted cost of the next one still
+        // fits in the remaining time; the estimate is refreshed from every pass rendered.
+        // When a whole pass no longer fits, the tiles that do fit get one last pass, and the
+        // render stops. Every tile pass that starts runs to completion, so the budget may be
+        // overrun by about one tile.
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        int pass_grid = std::max(1, int(std::sqrt(pass_spp)));
+        uint32_t samples_per_pass = uint32_t(pass_grid * pass_grid);
+        uint32_t pass_count = std::max(1u, (uint32_t(samples_per_pixel) + samples_per_pass - 1) / samples_per_pass);
+
+        uint64_t hash = scene_hash(world, lights);
+        render_checkpoint accumulation(image_width, image_height, hash, samples_per_pass);
+
+        if (!checkpoint_file.empty())
+        {
+            render_checkpoint saved;
+            if (saved.load(checkpoint_file))
+            {
+                if (saved.scene_hash == hash && saved.width() == image_width && saved.height() == image_height
+                    && saved.pass_spp == samples_per_pass)
+                {
+                    accumulation = std::move(saved);
+                    std::clog << "Resuming from checkpoint after pass " << accumulation.passes_done << ".\n";
+                }
+                else
+                {
+                    std::clog << "Checkpoint '" << checkpoint_file << "' belongs to another scene; starting over.\n";
+                }
+            }
+        }
+
+        bool budgeted = (time_budget > 0);
+        int workers = resolve_thread_count(thread_count);
+        std::vector<double> tile_seconds(size_t(tile_count()), 0.0);  // Cost of one pass of each tile
+
+        // The pilot's samples are not mixed into the passes, whose stratification they would
+        // break, but they stand in for any pixel the budget left without a single pass.
+        render_checkpoint pilot(image_width, image_height, hash, 1);
+
+        if (budgeted && accumulation.passes_done < pass_count)
+        {
+            for_each_tile("Pilot pass, ", [&](int tile, int x0, int y0, int x1, int y1)
+            {
+                std::chrono::steady_clock::time_point tile_start = std::chrono::steady_clock::now();
+                render_tile_pass(x0, y0, x1, y1, 0, 1, world, lights, pilot);
+                tile_seconds[tile] = samples_per_pass * seconds_since(tile_start);
+            });
+
+            double pass_estimate = sum_of(tile_seconds) / workers;
+            double remaining = time_budget - seconds_since(start);
+            std::clog << "\rPilot pass: about " << pass_estimate << " s per pass of " << samples_per_pass
+                      << " spp, so " << std::min(double(pass_count - accumulation.passes_done),
+                                                 std::floor(std::fmax(0, remaining) / pass_estimate))
+                      << " passes fit in the remaining " << remaining << " s.\n";
+        }
+
+        std::chrono::steady_clock::time_point last_save = std::chrono::steady_clock::now();
+        std::vector<int> tiles(tile_seconds.size());
+        for (int tile = 0; tile < int(tiles.size()); tile++)
+        {
+            tiles[tile] = tile;
+        }
+
+        while (accumulation.passes_done < pass_count)
+        {
+            uint32_t pass = accumulation.passes_done;
+            bool final_partial_pass = false;
+
+            if (budgeted)
+            {
+                double remaining = time_budget - seconds_since(start);
+                if (sum_of(tile_seconds) / workers > remaining)
+                {
+                    // Keep the tiles, in order, whose predicted cost still fits.
+                    std::vector<int> fitting_tiles;
+                    double planned = 0;
+                    for (int tile : tiles)
+                    {
+                        if ((planned + tile_seconds[tile]) / workers <= remaining)
+                        {
+                            fitting_tiles.push_back(tile);
+                            planned += tile_seconds[tile];
+                        }
+                    }
+
+                    tiles = fitting_tiles;
+                    final_partial_pass = true;
+                }
+            }
+
+            std::string status = "Pass " + std::to_string(pass + 1) + "/" + std::to_string(pass_count) + ", ";
+            for_each_tile(status, tiles, [&](int tile, int x0, int y0, int x1, int y1)
+            {
+                std::chrono::steady_clock::time_point tile_start = std::chrono::steady_clock::now();
+                render_tile_pass(x0, y0, x1, y1, pass, pass_grid, world, lights, accumulation);
+                tile_seconds[tile] = seconds_since(tile_start);
+            });
+
+            if (final_partial_pass)
+            {
+                break;
+            }
+
+            accumulation.passes_done++;
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            bool interval_elapsed = (std::chrono::duration<double>(now - last_save).count() >= checkpoint_interval);
+            if (!checkpoint_file.empty() && (interval_elapsed || accumulation.passes_done == pass_count))
+            {
+                accumulation.save(checkpoint_file);
+                last_save = now;
+            }
+        }
+
+        if (budgeted)
+        {
+            if (!checkpoint_file.empty())
+            {
+                accumulation.save(checkpoint_file);
+            }
+
+            report_tile_samples(accumulation, pilot, seconds_since(start));
+        }
+
+        for (int j = 0; j < image_height; ++j)
+        {
+            for (int i = 0; i < image_width; ++i)
+            {
+                bool unrendered = (accumulation.sample_count(i, j) == 0);
+                image.set(i, j, (unrendered ? pilot : accumulation).mean(i, j));
+            }
+        }
+    }
+
+    void report_tile_samples(const render_checkpoint& accumulation, const render_checkpoint& pilot,
+                             double seconds) const
+    {
+        // Prints the samples per pixel each tile reached, one row of tiles per line. Tiles
+        // that only have their pilot sample show 1.
+
+        std::clog << "\rRendered in " << seconds << " s of a " << time_budget << " s budget."
+                  << " Samples per pixel by tile:\n";
+
+        for (int y0 = 0; y0 < image_height; y0 += tile_size)
+        {
+            for (int x0 = 0; x0 < image_width; x0 += tile_size)
+            {
+                uint32_t count = accumulation.sample_count(x0, y0);
+                std::clog << std::setw(6) << (count > 0 ? count : pilot.sample_count(x0, y0));
+            }
+            std::clog << '\n';
+        }
+    }
+
+    static double seconds_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static double sum_of(const std::vector<double>& values)
+    {
+        double sum = 0;
+        for (double value : values)
+        {
+            sum += value;
+        }
+        return sum;
+    }
+
+    void render_tile_pass(int x0, int y0, int x1, int y1, uint32_t pass, int pass_grid, const hittable& world,
+                          const hittable& lights, render_checkpoint& accumulation) const
+    {
+        // Adds one pass of pass_grid x pass_grid stratified samples to each pixel of the tile.
+        // Each pass draws its own sample indices, so passes never repeat one another. Pixels
+        // that already hold this pass (a budgeted render's final partial pass, resumed) are
+        // left alone.
+
+        uint32_t samples_per_pass = uint32_t(pass_grid * pass_grid);
+        double cell_size = 1.0 / pass_grid;
+
+        for (int j = y0; j < y1; ++j)
+        {
+            for (int i = x0; i < x1; ++i)
+            {
+                if (accumulation.sample_count(i, j) > pass * samples_per_pass)
+                {
+                    continue;
+                }
+
+                color pixel_color(0, 0, 0);
+                for (int s_j = 0; s_j < pass_grid; s_j++)
+                {
+                    for (int s_i = 0; s_i < pass_grid; s_i++)
+                    {
+                        uint32_t sample_index = pass * samples_per_pass + uint32_t(s_j * pass_grid + s_i);
+                        sampler s(uint32_t(j * image_width + i), sample_index);
+                        ray r = get_ray(i, j, s_i, s_j, cell_size, s);
+                        pixel_color += ray_color(r, world, lights, s);
+                    }
+                }
+                accumulation.add(i, j, pixel_color, samples_per_pass);
+            }
+        }
+    }
+
+    uint64_t scene_hash(const hittable& world, const hittable& lights) const
+    {
+        // Fingerprints everything that changes what a sample means: the camera and integrator
+        // settings, then the content of the world and the lights, down to every primitive's
+        // geometry and its material's and textures' parameters.
+
+        std::vector<double> settings = {
+            double(image_width), double(image_height), vfov, defocus_angle, focus_dist,
+            lookfrom.x(), lookfrom.y(), lookfrom.z(), lookat.x(), lookat.y(), lookat.z(),
+            vup.x(), vup.y(), vup.z(), background.x(), background.y(), background.z(),
+            double(max_depth), double(russian_roulette), double(rr_min_depth), double(next_event_estimation)
+        };
+
+        uint64_t hash = hash_bytes(hash_seed, settings.data(), settings.size() * sizeof(double));
+        world.hash_content(hash);
+        lights.hash_content(hash);
+        return hash;
+    }
+
+    long long render_tile(int x0, int y0, int x1, int y1, const hittable& world, const hittable& lights,
+                          framebuffer& image) const
+    {
+        // Renders the pixels [x0,x1) x [y0,y1) into the framebuffer and returns the number of
+        // camera samples it took.
+
+        if (adaptive_sampling)
+        {
+            return render_tile_adaptive(x0, y0, x1, y1, world, lights, image);
+        }
+        if (ray_packets)
+        {
+            return render_tile_packets(x0, y0, x1, y1, world, lights, image);
+        }
+
+        long long samples_taken = 0;
+
+        for (int j = y0; j < y1; ++j)
+        {
+            for (int i = x0; i < x1; ++i)
+            {
+                color pixel_color(0, 0, 0);
+                for (int s_j = 0; s_j < sqrt_spp; s_j++)
+                {
+                    for (int s_i = 0; s_i < sqrt_spp; s_i++)
+                    {
+                        sampler s(uint32_t(j * image_width + i), uint32_t(s_j * sqrt_spp + s_i));
+                        ray r = get_ray(i, j, s_i, s_j, s);
+                        pixel_color += ray_color(r, world, lights, s);
+                    }
+                }
+                image.set(i, j, pixel_samples_scale * pixel_color);
+                samples_taken += sqrt_spp * sqrt_spp;
+            }
+        }
+
+        return samples_taken;
+    }
+
+    long long render_tile_packets(int x0, int y0, int x1, int y1, const hittable& world, const hittable& lights,
+                                  framebuffer& image) const
+    {
+        // render_tile for coherent camera rays. The tile is cut into blocks of one packet's
+        // worth of pixels (2x2, 4x2 or 4x4), and each stratum's camera rays for a block go
+        // through the scene together as one packet. Every lane then follows the rest of its
+        // path alone, since rays that have bounced no longer travel together. Samples are drawn
+        // and summed in the same order as render_tile, so the image is the same.
+
+        const int block_width = (ray_packet::width == 4 ? 2 : 4);
+        const int block_height = ray_packet::width / block_width;
+        long long samples_taken = 0;
+
+        for (int block_y = y0; block_y < y1; block_y += block_height)
+        {
+            for (int block_x = x0; block_x < x1; block_x += block_width)
+            {
+                color pixel_colors[ray_packet::width];
+
+                for (int s_j = 0; s_j < sqrt_spp; s_j++)
+                {
+                    for (int s_i = 0; s_i < sqrt_spp; s_i++)
+                    {
+                        ray_packet packet;
+                        ray rays[ray_packet::width];
+                        sampler samplers[ray_packet::width];
+
+                        for (int lane = 0; lane < ray_packet::width; lane++)
+                        {
+                            int i = block_x + lane % block_width;
+                            int j = block_y + lane / block_width;
+                            if (i < x1 && j < y1)
+                            {
+                                samplers[lane] = sampler(uint32_t(j * image_width + i), uint32_t(s_j * sqrt_spp + s_i));
+                                rays[lane] = get_ray(i, j, s_i, s_j, samplers[lane]);
+                                packet.set(lane, rays[lane], interval(0, infinity));
+                            }
+                            else
+                            {
+                                packet.clear(lane);
+                            }
+                        }
+
+                        hit_record recs[ray_packet::width];
+                        uint32_t hits = world.hit_packet(packet, recs);
+
+                        for (int lane = 0; lane < ray_packet::width; lane++)
+                        {
+                            if (ray_packet::lane_set(packet.active, lane))
+                            {
+                                pixel_colors[lane] += ray_color(rays[lane], ray_packet::lane_set(hits, lane), recs[lane],
+                                                                world, lights, samplers[lane]);
+                            }
+                        }
+                    }
+                }
+
+                for (int lane = 0; lane < ray_packet::width; lane++)
+                {
+                    int i = block_x + lane % block_width;
+                    int j = block_y + lane / block_width;
+                    if (i < x1 && j < y1)
+                    {
+                        image.set(i, j, pixel_samples_scale * pixel_colors[lane]);
+                        samples_taken += sqrt_spp * sqrt_spp;
+                    }
+                }
+            }
+        }
+
+        return samples_taken;
+    }
+
+    struct pixel_estimate
+    {
+        color  sum = color(0, 0, 0);     // Sum of the radiance samples
+        double mean = 0;                 // Running mean of the sample luminance
+        double squared_deviations = 0;   // Welford's sum of squared luminance deviations
+        int    n = 0;                    // Samples taken
+        bool   converged = false;
+    };
+
+    long long render_tile_adaptive(int x0, int y0, int x1, int y1, const hittable& world,
+                                   const hittable& lights, framebuffer& image) const
+    {
+        // Samples the tile in passes. After each pass a pixel is converged once the standard
+        // error of its mean luminance is below adaptive_threshold times that mean, floored at
+        // one 8-bit step of linear intensity so black pixels can converge too.
+        //
+        // A pixel whose first samples all missed a rare bright path (a caustic seen through
+        // glass, say) looks perfectly converged at zero. So a pixel keeps sampling while any
+        // pixel in its 3x3 neighbourhood has not converged, which lets a caustic found next
+        // door pull it back in.
+        //
+        // Pixels are sampled in batches of 16, each stratified over its own 4x4 grid, so a
+        // pixel that stops early has still covered its whole footprint evenly.
+
+        const int batch_grid = 4;
+        const int batch_size = batch_grid * batch_grid;
+        int min_spp = round_up_to_batch(std::max(2, adaptive_min_spp), batch_size);
+        int max_spp = round_up_to_batch(std::max(min_spp, (adaptive_max_spp > 0 ? adaptive_max_spp : samples_per_pixel)), batch_size);
+
+        int width = x1 - x0;
+        int height = y1 - y0;
+        std::vector<pixel_estimate> pixels(size_t(width) * height);
+        std::vector<char> active(pixels.size(), 1);
+        long long samples_taken = 0;
+
+        for (int target = min_spp; ; target = std::min(max_spp, target + batch_size))
+        {
+            bool any_active = false;
+
+            for (int j = y0; j < y1; ++j)
+            {
+                for (int i = x0; i < x1; ++i)
+                {
+                    size_t index = size_t(j - y0) * width + (i - x0);
+                    if (!active[index])
+                    {
+                        continue;
+                    }
+
+                    pixel_estimate& pixel = pixels[index];
+                    for (; pixel.n < target; pixel.n++)
+                    {
+                        sampler s(uint32_t(j * image_width + i), uint32_t(pixel.n));
+                        int stratum = pixel.n % batch_size;
+                        ray r = get_ray(i, j, stratum % batch_grid, stratum / batch_grid, 1.0 / batch_grid, s);
+                        color sample = ray_color(r, world, lights, s);
+                        pixel.sum += sample;
+
+                        double y = luminance(sample);
+                        double delta = y - pixel.mean;
+                        pixel.mean += delta / (pixel.n + 1);
+                        pixel.squared_deviations += delta * (y - pixel.mean);
+                        samples_taken++;
+                    }
+
+                    double standard_error = std::sqrt(pixel.squared_deviations / (double(pixel.n - 1) * pixel.n));
+                    pixel.converged = (standard_error <= adaptive_threshold * std::fmax(pixel.mean, 1.0 / 256));
+                }
+            }
+
+            if (target >= max_spp)
+            {
+                break;
+            }
+
+            for (int j = 0; j < height; ++j)
+            {
+                for (int i = 0; i < width; ++i)
+                {
+                    bool neighbourhood_converged = true;
+                    for (int dj = std::max(0, j - 1); dj <= std::min(height - 1, j + 1); dj++)
+                    {
+                        for (int di = std::max(0, i - 1); di <= std::min(width - 1, i + 1); di++)
+                        {
+                            neighbourhood_converged = neighbourhood_converged && pixels[size_t(dj) * width + di].converged;
+                        }
+                    }
+
+                    active[size_t(j) * width + i] = !neighbourhood_converged;
+                    any_active = any_active || !neighbourhood_converged;
+                }
+            }
+
+            if (!any_active)
+            {
+                break;
+            }
+        }
+
+        for (int j = y0; j < y1; ++j)
+        {
+            for (int i = x0; i < x1; ++i)
+            {
+                const pixel_estimate& pixel = pixels[size_t(j - y0) * width + (i - x0)];
+                image.set(i, j, pixel.sum / pixel.n);
+            }
+        }
+
+        return samples_taken;
+    }
+
+    ray get_ray(int i, int j, int s_i, int s_j, sampler& s) const
+    {
+        return get_ray(i, j, s_i, s_j, recip_sqrt_spp, s);
+    }
+
+    ray get_ray(int i, int j, int s_i, int s_j, double cell_size, sampler& s) const
     {
         // Construct a camera ray originating from the defocus disk and directed at a randomly
-        // sampled point around the pixel location i, j for stratified sample square s_i, s_j.
+        // sampled point around the pixel location i, j for stratified sample square s_i, s_j
+        // of a grid with the given cell size.
+
+        s.start_bounce(0);
 
-        vec3 offset = sample_square_stratified(s_i, s_j);
+        vec3 offset = sample_square_stratified(s_i, s_j, cell_size, s);
         vec3 pixel_sample = pixel00_loc  + ((i + offset.x()) * pixel_delta_u) + ((j + offset.y()) * pixel_delta_v);
 
-        vec3 ray_origin = ((defocus_angle <= 0) ? center : defocus_disk_sample());
+        vec3 ray_origin = ((defocus_angle <= 0) ? center : defocus_disk_sample(s));
         vec3 ray_direction = pixel_sample - ray_origin;
-        double ray_time = random_double();
+        double ray_time = random_double(s);
 
         return ray(ray_origin, ray_direction, ray_time);
     }
 
-    vec3 sample_square_stratified(int s_i, int s_j) const
+    vec3 sample_square_stratified(int s_i, int s_j, double cell_size, sampler& s) const
     {
         // Returns the vector to a random point in the square sub-pixel specified by grid
         // indices s_i and s_j, for an idealized unit square pixel [-.5,-.5] to [+.5,+.5].
 
-        double px = ((s_i + random_double()) * recip_sqrt_spp) - 0.5;
-        double py = ((s_j + random_double()) * recip_sqrt_spp) - 0.5;
+        double px = ((s_i + random_double(s)) * cell_size) - 0.5;
+        double py = ((s_j + random_double(s)) * cell_size) - 0.5;
 
         return vec3(px, py, 0);
     }
 
-    vec3 sample_square() const
+    vec3 sample_square(sampler& s) const
     {
         // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square.
-        return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+        double px = random_double(s) - 0.5;
+        double py = random_double(s) - 0.5;
+        return vec3(px, py, 0);
     }
 
-    point3 defocus_disk_sample() const
+    point3 defocus_disk_sample(sampler& s) const
     {
         // Returns a random point in the camera defocus disk.
-        vec3 p = random_in_unit_disk();
+        vec3 p = random_in_unit_disk(s);
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
-    color ray_color(const ray& r, int depth, const hittable& world, const hittable& lights) const
+    void render_wavefront(const hittable& world, const hittable& lights, framebuffer& image) const
     {
-        // If we've exceeded the ray bounce limit, no more light is gathered.
-        if (depth <= 0)
+        // Breadth-first alternative to render_tile. A batch of whole pixels' worth of paths
+        // advances one bounce at a time through separate stages, each a parallel kernel over a
+        // structure-of-arrays queue:
+        //
+        //   generate  camera rays for every sample of the batch's pixels
+        //   extend    closest hit for every queued ray
+        //   shade     emission, light sampling and continuation, grouped by material type
+        //   shadow    occlusion tests for the light samples
+        //   compact   survivors moved to the front of the queue for the next bounce
+        //
+        // Shading goes through the same shade_hit as ray_color, draws the same sampler
+        // dimensions, and each pixel sums its samples in the same order, so both integrators
+        // produce the same image.
+
+        const size_t chunk_size = 1024;
+        int spp = sqrt_spp * sqrt_spp;
+        int pixel_count = image_width * image_height;
+        int pixels_per_batch = std::max(1, wavefront_paths / spp);
+        size_t capacity = size_t(pixels_per_batch) * spp;
+
+        path_queue current, next;
+        shadow_queue shadows;
+        current.reserve(capacity);
+        next.reserve(capacity);
+        shadows.reserve(capacity);
+
+        std::vector<hit_record> hits(capacity);
+        std::vector<char> did_hit(capacity);
+        std::vector<char> alive(capacity);
+        std::vector<uint32_t> shade_order(capacity);
+        material_sort shading_sort;
+        shading_sort.reserve(capacity, chunk_size, thread_count);
+        std::vector<color> radiance(capacity);
+
+        // Extend-stage batches, one slice per chunk, allocated once for the whole render.
+        std::vector<ray> batch_rays(capacity);
+        std::vector<interval> batch_closest(capacity);
+        std::vector<uint32_t> batch_indices(capacity);
+
+        int batch_count = (pixel_count + pixels_per_batch - 1) / pixels_per_batch;
+
+        for (int batch = 0; batch < batch_count; batch++)
         {
-            return color(0, 0, 0);
+            int first_pixel = batch * pixels_per_batch;
+            int batch_pixels = std::min(pixels_per_batch, pixel_count - first_pixel);
+            size_t path_count = size_t(batch_pixels) * spp;
+
+            // Generate.
+            parallel_for_chunks(path_count, chunk_size, thread_count, [&](size_t begin, size_t end)
+            {
+                for (size_t k = begin; k < end; k++)
+                {
+                    uint32_t pixel = uint32_t(first_pixel) + uint32_t(k / spp);
+                    uint32_t sample_index = uint32_t(k % spp);
+
+                    sampler s(pixel, sample_index);
+                    ray r = get_ray(int(pixel) % image_width, int(pixel) / image_width, int(sample_index) % sqrt_spp,
+                                    int(sample_index) / sqrt_spp, s);
+                    current.set(k, r, color(1, 1, 1), uint32_t(k), true);
+                    radiance[k] = color(0, 0, 0);
+                }
+            });
+            current.size = path_count;
+
+            for (int bounce = 1; bounce <= max_depth && current.size > 0; bounce++)
+            {
+                size_t queue_size = current.size;
+
+                // Extend. Each chunk goes to the scene as one batch query.
+                parallel_for_chunks(queue_size, chunk_size, thread_count, [&](size_t begin, size_t end)
+                {
+                    size_t count = end - begin;
+                    ray* rays = &batch_rays[begin];
+                    interval* closest = &batch_closest[begin];
+                    uint32_t* indices = &batch_indices[begin];
+                    for (size_t i = 0; i < count; i++)
+                    {
+                        rays[i] = current.get_ray(begin + i);
+                        closest[i] = interval(0, infinity);
+                        indices[i] = uint32_t(i);
+                        did_hit[begin + i] = 0;
+                    }
+
+                    world.hit_batch(rays, indices, count, closest, &hits[begin], &did_hit[begin]);
+                });
+
+                // Shade.
+                shading_sort.sort(queue_size, did_hit, hits, shade_order, chunk_size, thread_count);
+                parallel_for_chunks(queue_size, chunk_size, thread_count, [&](size_t begin, size_t end)
+                {
+                    for (size_t n = begin; n < end; n++)
+                    {
+                        size_t k = shade_order[n];
+                        uint32_t path = current.path[k];
+                        color throughput = current.throughput(k);
+
+                        shadows.active[k] = 0;
+                        alive[k] = 0;
+
+                        if (!did_hit[k])
+                        {
+                            radiance[path] += throughput * background;
+                            continue;
+                        }
+
+                        sampler s(uint32_t(first_pixel + int(path / spp)), path % spp);
+                        s.start_bounce(uint32_t(bounce));
+
+                        bool count_emission = (current.count_emission[k] != 0);
+                        path_vertex vertex = shade_hit(current.get_ray(k), hits[k], bounce, lights, s,
+                                                       throughput, count_emission);
+                        radiance[path] += vertex.emitted;
+
+                        if (vertex.has_shadow_ray)
+                        {
+                            shadows.set(k, vertex.shadow_ray, vertex.shadow_t_max, vertex.direct);
+                        }
+
+                        if (vertex.continues)
+                        {
+                            next.set(k, vertex.next_ray, throughput, path, count_emission);
+                            alive[k] = 1;
+                        }
+                    }
+                });
+
+                // Shadow.
+                if (next_event_estimation)
+                {
+                    parallel_for_chunks(queue_size, chunk_size, thread_count, [&](size_t begin, size_t end)
+                    {
+                        for (size_t k = begin; k < end; k++)
+                        {
+                            if (shadows.active[k] && !world.occluded(shadows.get_ray(k), interval(0, shadows.t_max[k])))
+                            {
+                                radiance[current.path[k]] += shadows.direct(k);
+                            }
+                        }
+                    });
+                }
+
+                // Compact.
+                next.size = queue_size;
+                compact_paths(next, alive, current, chunk_size, thread_count);
+            }
+
+            // Sum each pixel's samples in sample order, as render_tile does.
+            parallel_for_chunks(size_t(batch_pixels), 64, thread_count, [&](size_t begin, size_t end)
+            {
+                for (size_t p = begin; p < end; p++)
+                {
+                    color pixel_color(0, 0, 0);
+                    for (int sample = 0; sample < spp; sample++)
+                    {
+                        pixel_color += radiance[p * spp + sample];
+                    }
+
+                    int pixel = first_pixel + int(p);
+                    image.set(pixel % image_width, pixel / image_width, pixel_samples_scale * pixel_color);
+                }
+            });
+
+            std::clog << "\rWavefront batches remaining: " << (batch_count - batch - 1) << ' ' << std::flush;
         }
+    }
 
+    color ray_color(const ray& camera_ray, const hittable& world, const hittable& lights, sampler& s) const
+    {
         hit_record rec;
+        bool camera_ray_hit = world.hit(camera_ray, interval(0, infinity), rec);
+        return ray_color(camera_ray, camera_ray_hit, rec, world, lights, s);
+    }
+
+    color ray_color(const ray& camera_ray, bool camera_ray_hit, const hit_record& camera_hit, const hittable& world,
+                    const hittable& lights, sampler& s) const
+    {
+        // Follows one light path iteratively, given the camera ray's intersection (found by the
+        // caller, possibly as part of a packet). `throughput` carries the product of every
+        // attenuation * scattering_pdf / pdf factor so far, and each emitter the path reaches
+        // adds its light scaled by it.
+
+        color radiance(0, 0, 0);
+        color throughput(1, 1, 1);
+        ray r = camera_ray;
+
+        // With next-event estimation, direct light comes from an explicit shadow ray, so a
+        // BSDF-sampled bounce must not count emitters it happens to hit, or they would be
+        // counted twice. Specular bounces have no shadow ray and count them as usual.
+        bool count_emission = true;
+
+        for (int bounce = 1; bounce <= max_depth; bounce++)
+        {
+            s.start_bounce(uint32_t(bounce));
+
+            hit_record rec = camera_hit;
+            bool did_hit = (bounce == 1 ? camera_ray_hit : world.hit(r, interval(0, infinity), rec));
+
+            // If the ray hits nothing, gather the background color.
+            if (!did_hit)
+            {
+                radiance += throughput * background;
+                break;
+            }
+
+            path_vertex vertex = shade_hit(r, rec, bounce, lights, s, throughput, count_emission);
+            radiance += vertex.emitted;
+
+            if (vertex.has_shadow_ray && !world.occluded(vertex.shadow_ray, interval(0, vertex.shadow_t_max)))
+            {
+                radiance += vertex.direct;
+            }
+
+            if (!vertex.continues)
+            {
+                break;
+            }
+            r = vertex.next_ray;
+        }
+
+        return radiance;
+    }
+
+    struct path_vertex
+    {
+        // What shading one hit adds to its path. The shadow ray is left for the caller to
+        // trace, so the same shading serves both the per-path and the wavefront integrator.
+
+        color  emitted;                 // Emitted light at the hit, weighted by the path throughput
+        bool   has_shadow_ray = false;
+        ray    shadow_ray;              // Next-event estimation ray toward a light
+        double shadow_t_max = 0;        // Where the shadow ray reaches the light
+        color  direct;                  // Weighted light the shadow ray carries if unblocked
+        bool   continues = false;       // Whether the path goes on past this hit
+        ray    next_ray;
+    };
+
+    path_vertex shade_hit(const ray& r, const hit_record& rec, int bounce, const hittable& lights, sampler& s,
+                          color& throughput, bool& count_emission) const
+    {
+        // Gathers emission at the hit, samples its direct light when next-event estimation is
+        // on, and samples the continuation, updating the path throughput and emission flag.
+
+        path_vertex vertex;
 
-        // If the ray hits nothing, return the background color.
-        if (!world.hit(r, interval(0.001, infinity), rec))
+        if (count_emission)
         {
-            return background;
+            vertex.emitted = throughput * rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
         }
 
         scatter_record srec;
-        color color_from_emission = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
-
-        if (!rec.mat->scatter(r, rec, srec))
+        if (!rec.mat->scatter(r, rec, srec, s))
         {
-            return color_from_emission;
+            return vertex;
         }
 
         if (srec.skip_pdf)
         {
-            return srec.attenuation * ray_color(srec.skip_pdf_ray, depth - 1, world, lights);
+            throughput = throughput * srec.attenuation;
+            vertex.next_ray = srec.skip_pdf_ray;
+            count_emission = true;
+        }
+        else if (next_event_estimation)
+        {
+            sample_direct_light(r, rec, srec, lights, s, throughput, vertex);
+
+            ray scattered = rec.spawn_ray(pdf_generate(srec.pdf, s), r.time());
+            double surface_pdf_value = pdf_value(srec.pdf, scattered.direction());
+            double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+
+            throughput = throughput * srec.attenuation * (scattering_pdf / surface_pdf_value);
+            vertex.next_ray = scattered;
+            count_emission = false;
+        }
+        else
+        {
+            hittable_pdf light_pdf(lights, rec.p);
+            mixture_pdf p(light_pdf, srec.pdf);
+
+            ray scattered = rec.spawn_ray(p.generate(s), r.time());
+            double pdf_value = p.value(scattered.direction());
+            double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+
+            throughput = throughput * srec.attenuation * (scattering_pdf / pdf_value);
+            vertex.next_ray = scattered;
+            count_emission = true;
+        }
+
+        // Past the minimum depth, end dim paths at random and boost the survivors by the
+        // inverse survival chance, which keeps the estimate unbiased. The cap keeps even
+        // bright paths from running until max_depth.
+        if (russian_roulette && bounce >= rr_min_depth)
+        {
+            double survival = std::fmin(max_component(throughput), 0.95);
+            if (random_double(s) >= survival)
+            {
+                return vertex;
+            }
+            throughput /= survival;
         }
 
-        shared_ptr<hittable_pdf> light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-        mixture_pdf p(light_ptr, srec.pdf_ptr);
+        vertex.continues = true;
+        return vertex;
+    }
+
+    static double max_component(const color& c)
+    {
+        return std::fmax(c.x(), std::fmax(c.y(), c.z()));
+    }
+
+    static int round_up_to_batch(int count, int batch_size)
+    {
+        return (count + batch_size - 1) / batch_size * batch_size;
+    }
 
-        ray scattered = ray(rec.p, p.generate(), r.time());
-        double pdf_value = p.value(scattered.direction());
+    static double luminance(const color& c)
+    {
+        // Rec. 709 weights for linear RGB.
+        return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+    }
+
+    void sample_direct_light(const ray& r, const hit_record& rec, const scatter_record& srec,
+                             const hittable& lights, sampler& s, const color& throughput,
+                             path_vertex& vertex) const
+    {
+        // Samples a point on the lights and sets up the shadow ray toward it along with the
+        // contribution it carries if unoccluded. The lights list must carry the emitting
+        // materials; members without one (sampling targets such as glass) simply contribute
+        // nothing, and the full list pdf keeps the estimate unbiased.
+
+        ray shadow = rec.spawn_ray(lights.random(rec.p, s), r.time());
+        double light_pdf = lights.pdf_value(shadow.origin(), shadow.direction());
+        if (light_pdf <= 0)
+        {
+            return;
+        }
+
+        hit_record light_rec;
+        if (!lights.hit(shadow, interval(0, infinity), light_rec) || !light_rec.mat)
+        {
+            return;
+        }
 
-        double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+        color emitted = light_rec.mat->emitted(shadow, light_rec, light_rec.u, light_rec.v, light_rec.p);
+        double scattering_pdf = rec.mat->scattering_pdf(r, rec, shadow);
 
-        color sample_color = ray_color(scattered, depth - 1, world, lights);
-        color color_from_scatter = (srec.attenuation * scattering_pdf * sample_color) / pdf_value;
+        vertex.has_shadow_ray = true;
+        vertex.shadow_ray = shadow;
+        vertex.direct = throughput * ((srec.attenuation * scattering_pdf * emitted) / light_pdf);
 
-        return color_from_emission + color_from_scatter;
+        // Stop just short of the light so the emitter's own copy in the world does not count
+        // as a blocker.
+        vertex.shadow_t_max = light_rec.t * (1 - 1e-6);
     }
 };
 
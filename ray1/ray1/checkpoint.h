@@ -0,0 +1,194 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+class render_checkpoint
+{
+public:
+    // Accumulation state of a progressive render: the per-pixel radiance sums and sample
+    // counts, how many passes have been added, and a hash of the scene and camera settings
+    // the samples came from. Saved to disk it lets a later run resume and keep adding passes.
+    //
+    // The file is a raw dump in host byte order, meant to be read back by the same build on
+    // the same machine:
+    //
+    //   "RTCKPT01", scene hash (u64), width, height (i32), pass spp, passes done (u32),
+    //   sample counts (u32 per pixel), radiance sums (3 doubles per pixel)
+
+    uint64_t scene_hash = 0;
+    uint32_t pass_spp = 0;       // Samples per pixel that one pass adds
+    uint32_t passes_done = 0;    // Passes accumulated so far; also the next pass's RNG index
+
+    render_checkpoint() : image_width(0), image_height(0) {}
+
+    render_checkpoint(int width, int height, uint64_t scene_hash, uint32_t pass_spp)
+        : scene_hash(scene_hash), pass_spp(pass_spp), image_width(width), image_height(height),
+        counts(size_t(width) * height, 0), sums(size_t(width) * height * 3, 0.0)
+    {}
+
+    int width() const { return image_width; }
+    int height() const { return image_height; }
+
+    void add(int i, int j, const color& sample_sum, uint32_t sample_count)
+    {
+        // Workers add disjoint pixels, so no locking is needed.
+        size_t pixel = size_t(j) * image_width + i;
+        sums[pixel * 3 + 0] += sample_sum.x();
+        sums[pixel * 3 + 1] += sample_sum.y();
+        sums[pixel * 3 + 2] += sample_sum.z();
+        counts[pixel] += sample_count;
+    }
+
+    uint32_t sample_count(int i, int j) const
+    {
+        return counts[size_t(j) * image_width + i];
+    }
+
+    color mean(int i, int j) const
+    {
+        size_t pixel = size_t(j) * image_width + i;
+        if (counts[pixel] == 0)
+        {
+            return color(0, 0, 0);
+        }
+
+        return color(sums[pixel * 3 + 0], sums[pixel * 3 + 1], sums[pixel * 3 + 2]) / counts[pixel];
+    }
+
+    bool save(const std::string& filename) const
+    {
+        // Write to a scratch file first, then move it over the old checkpoint in one atomic
+        // replace, so a crash at any point leaves a complete checkpoint behind.
+
+        std::string scratch = filename + ".tmp";
+        {
+            std::ofstream file(scratch, std::ios::binary);
+            if (!file)
+            {
+                std::cerr << "ERROR: Could not open checkpoint file '" << scratch << "' for writing.\n";
+                return false;
+            }
+
+            file.write(magic, sizeof(magic));
+            write_value(file, scene_hash);
+            write_value(file, int32_t(image_width));
+            write_value(file, int32_t(image_height));
+            write_value(file, pass_spp);
+            write_value(file, passes_done);
+            file.write(reinterpret_cast<const char*>(counts.data()), std::streamsize(counts.size() * sizeof(uint32_t)));
+            file.write(reinterpret_cast<const char*>(sums.data()), std::streamsize(sums.size() * sizeof(double)));
+
+            // Closing flushes the buffered tail, which can fail too.
+            file.close();
+            if (!file)
+            {
+                std::cerr << "ERROR: Could not write checkpoint file '" << scratch << "'.\n";
+                return false;
+            }
+        }
+
+#ifdef _WIN32
+        // rename() will not replace an existing file on Windows.
+        bool moved = (MoveFileExA(scratch.c_str(), filename.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0);
+#else
+        bool moved = (std::rename(scratch.c_str(), filename.c_str()) == 0);
+#endif
+        if (!moved)
+        {
+            std::cerr << "ERROR: Could not rename '" << scratch << "' to '" << filename << "'.\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    bool load(const std::string& filename)
+    {
+        // Returns false, leaving this checkpoint untouched, if the file is missing or is not
+        // a complete checkpoint. Falls back to the scratch file of an interrupted save(),
+        // which is used only if it was completely written.
+
+        return load_file(filename) || load_file(filename + ".tmp");
+    }
+
+private:
+    static constexpr char magic[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '0', '1' };
+
+    int image_width;
+    int image_height;
+    std::vector<uint32_t> counts;
+    std::vector<double> sums;
+
+    bool load_file(const std::string& filename)
+    {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file)
+        {
+            return false;
+        }
+
+        char file_magic[sizeof(magic)];
+        file.read(file_magic, sizeof(file_magic));
+        if (!file || std::memcmp(file_magic, magic, sizeof(magic)) != 0)
+        {
+            return false;
+        }
+
+        render_checkpoint loaded;
+        int32_t width = 0;
+        int32_t height = 0;
+        read_value(file, loaded.scene_hash);
+        read_value(file, width);
+        read_value(file, height);
+        read_value(file, loaded.pass_spp);
+        read_value(file, loaded.passes_done);
+        if (!file || width <= 0 || height <= 0)
+        {
+            return false;
+        }
+
+        loaded.image_width = width;
+        loaded.image_height = height;
+        loaded.counts.resize(size_t(width) * height);
+        loaded.sums.resize(size_t(width) * height * 3);
+        file.read(reinterpret_cast<char*>(loaded.counts.data()), std::streamsize(loaded.counts.size() * sizeof(uint32_t)));
+        file.read(reinterpret_cast<char*>(loaded.sums.data()), std::streamsize(loaded.sums.size() * sizeof(double)));
+        if (!file)
+        {
+            return false;
+        }
+
+        *this = std::move(loaded);
+        return true;
+    }
+
+    template<typename T>
+    static void write_value(std::ofstream& file, const T& value)
+    {
+        file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    static void read_value(std::ifstream& file, T& value)
+    {
+        file.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+};
+
+#endif
@@ -16,36 +16,27 @@ inline double linear_to_gamma(double linear_component)
 	return 0;
 }
 
-void write_color(std::ostream& out, const color& pixel_color)
+inline int to_byte(double linear_component)
 {
-	double r = pixel_color.x();
-	double g = pixel_color.y();
-	double b = pixel_color.z();
-
-	// Replace NaN components with zero.
-	if (r != r)
-	{
-		r = 0.0;
-	}
-	if (g != g)
-	{
-		g = 0.0;
-	}
-	if (b != b)
+	// Replace NaN with zero.
+	if (linear_component != linear_component)
 	{
-		b = 0.0;
+		linear_component = 0.0;
 	}
 
 	// Apply a linear to gamma transform for gamma 2
-	r = linear_to_gamma(r);
-	g = linear_to_gamma(g);
-	b = linear_to_gamma(b);
+	double gamma_component = linear_to_gamma(linear_component);
 
-	// Translate the [0,1] component values to the byte range [0,255].
+	// Translate the [0,1] component value to the byte range [0,255].
 	static const interval intensity(0.000, 0.999);
-	int rbyte = int(256 * intensity.clamp(r));
-	int gbyte = int(256 * intensity.clamp(g));
-	int bbyte = int(256 * intensity.clamp(b));
+	return int(256 * intensity.clamp(gamma_component));
+}
+
+void write_color(std::ostream& out, const color& pixel_color)
+{
+	int rbyte = to_byte(pixel_color.x());
+	int gbyte = to_byte(pixel_color.y());
+	int bbyte = to_byte(pixel_color.z());
 
 	// Write out the pixel color components.
 	out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
@@ -5,6 +5,8 @@
 #include "material.h"
 #include "texture.h"
 
+#include <cstring>
+
 class constant_medium : public hittable
 {
 public:
@@ -20,6 +22,54 @@ public:
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override
     {
+        double t;
+        if (!scatter_distance(r, ray_t, t))
+        {
+            return false;
+        }
+
+        rec.t = t;
+        rec.p = r.at(rec.t);
+        rec.p_error = 0;  // Not on a surface, so there is nothing to step off
+
+        rec.normal = vec3(1, 0, 0);  // arbitrary
+        rec.front_face = true;     // also arbitrary
+        rec.mat = phase_function.get();
+
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        // The free-flight sample is keyed on the ray, so this agrees with hit() exactly.
+        double t;
+        return scatter_distance(r, ray_t, t);
+    }
+
+    aabb bounding_box() const override { return boundary->bounding_box(); }
+
+    aabb bounding_box_at(double time) const override { return boundary->bounding_box_at(time); }
+
+    aabb refit_bounds() override { return boundary->refit_bounds(); }
+
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash_values(hash, { neg_inv_density });
+        boundary->hash_content(hash);
+        hash_material(hash, phase_function.get());
+    }
+
+private:
+    shared_ptr<hittable> boundary;
+    double neg_inv_density;
+    shared_ptr<material> phase_function;
+
+    bool scatter_distance(const ray& r, interval ray_t, double& t) const
+    {
+        // Samples where the ray scatters inside the medium, returning false if it passes
+        // through the part of the boundary that lies within ray_t.
+
         hit_record rec1, rec2;
 
         if (!boundary->hit(r, interval::universe, rec1))
@@ -53,29 +103,40 @@ public:
 
         double ray_length = r.direction().length();
         double distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-        double hit_distance = neg_inv_density * std::log(random_double());
+        sampler s = ray_sampler(r, rec1.t);
+        double hit_distance = neg_inv_density * std::log(random_double(s));
 
         if (hit_distance > distance_inside_boundary)
         {
             return false;
         }
 
-        rec.t = rec1.t + hit_distance / ray_length;
-        rec.p = r.at(rec.t);
-
-        rec.normal = vec3(1, 0, 0);  // arbitrary
-        rec.front_face = true;     // also arbitrary
-        rec.mat = phase_function;
-
+        t = rec1.t + hit_distance / ray_length;
         return true;
     }
 
-    aabb bounding_box() const override { return boundary->bounding_box(); }
+    static sampler ray_sampler(const ray& r, double t_enter)
+    {
+        // Keys the free-flight sample on the ray itself. The ray is fully determined by the
+        // sampler stream of the path that spawned it, so the distance drawn here is just as
+        // independent of thread and tile order, and hittable::hit needs no extra parameter.
+        // The entry distance decorrelates separate media crossed by the same ray.
 
-private:
-    shared_ptr<hittable> boundary;
-    double neg_inv_density;
-    shared_ptr<material> phase_function;
+        uint32_t key[8];
+        double values[4] = { r.origin().x(), r.origin().y(), r.origin().z(), t_enter };
+        std::memcpy(key, values, sizeof(key));
+
+        uint32_t direction_key[6];
+        double directions[3] = { r.direction().x(), r.direction().y(), r.direction().z() };
+        std::memcpy(direction_key, directions, sizeof(direction_key));
+
+        uint32_t a = sampler::hash(key[0], key[1], key[2], key[3]);
+        uint32_t b = sampler::hash(key[4], key[5], key[6], key[7]);
+        uint32_t c = sampler::hash(direction_key[0], direction_key[1], direction_key[2], direction_key[3]);
+        uint32_t d = sampler::hash(direction_key[4], direction_key[5], a, b);
+
+        return sampler(c, d);
+    }
 };
 
 #endif
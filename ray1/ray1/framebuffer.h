@@ -0,0 +1,48 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <vector>
+
+class framebuffer
+{
+public:
+    // Linear RGB image stored as three floats per pixel, row by row from the top-left corner.
+    // Workers write disjoint pixels, so no locking is needed while rendering.
+
+    framebuffer() : image_width(0), image_height(0) {}
+
+    framebuffer(int width, int height)
+        : image_width(width), image_height(height), pixels(size_t(width) * height * 3, 0.0f)
+    {}
+
+    int width() const { return image_width; }
+    int height() const { return image_height; }
+
+    void set(int i, int j, const color& pixel_color)
+    {
+        float* pixel = &pixels[index(i, j)];
+        pixel[0] = float(pixel_color.x());
+        pixel[1] = float(pixel_color.y());
+        pixel[2] = float(pixel_color.z());
+    }
+
+    color get(int i, int j) const
+    {
+        const float* pixel = &pixels[index(i, j)];
+        return color(pixel[0], pixel[1], pixel[2]);
+    }
+
+    const float* data() const { return pixels.data(); }
+
+private:
+    int image_width;
+    int image_height;
+    std::vector<float> pixels;
+
+    size_t index(int i, int j) const
+    {
+        return (size_t(j) * image_width + i) * 3;
+    }
+};
+
+#endif
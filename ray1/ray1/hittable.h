@@ -2,6 +2,8 @@
 #define HITTABLE_H
 
 #include "aabb.h"
+#include "affine.h"
+#include "ray_packet.h"
 
 class material;
 
@@ -10,7 +12,8 @@ class hit_record
 public:
 	point3 p; // hit point.
 	vec3 normal; // normal vector at hit point.
-	shared_ptr<material> mat;
+	const material* mat = nullptr;  // Borrowed from the hit object, so copying a record never touches a refcount
+	real p_error = 0; // bound on the rounding error in each component of p
 	double t; // time? t at (v = a + tb)
 	double u;
 	double v;
@@ -24,6 +27,24 @@ public:
 		front_face = (dot(r.direction(), outward_normal) < 0);
 		normal = (front_face ? outward_normal : -outward_normal);
 	}
+
+	ray spawn_ray(const vec3& direction, double time) const
+	{
+		// A ray leaving the hit point, starting just off the surface on the side it heads
+		// into, so it can be traced from t = 0 without finding this surface again.
+		vec3 side = (dot(direction, normal) < 0 ? -normal : normal);
+		return ray(offset_ray_origin(p, side, p_error), direction, time);
+	}
+};
+
+struct ray_hit
+{
+	// One hit reported by a stream query: the index of the ray that made it, and its record.
+	// The record is the full one rather than a (ray, t, primitive) triple to fill in later:
+	// records do not name the primitive they came from, and batch traversal has to write the
+	// closest record so far for each ray anyway, so hit_all() only gathers what exists.
+	uint32_t ray_index;
+	hit_record rec;
 };
 
 class hittable
@@ -35,15 +56,138 @@ public:
 
 	virtual aabb bounding_box() const = 0;
 
+	virtual aabb bounding_box_at(double time) const
+	{
+		// Bounds at one time of the shutter interval [0, 1]. Motion BVHs interpolate linearly
+		// between the boxes at 0 and 1, so for every time t the object must lie within that
+		// interpolation; linear motion satisfies this. A static box always does.
+		return bounding_box();
+	}
+
+	virtual aabb refit_bounds()
+	{
+		// Brings any bounds the object caches up to date after objects inside it moved, and
+		// returns its new box; bvh_node::refit() calls this on its children. Objects that
+		// cache nothing derived from other objects keep this fallback.
+		return bounding_box();
+	}
+
+	virtual bool occluded(const ray& r, interval ray_t) const
+	{
+		// Returns true if anything blocks the ray within ray_t. Overrides stop at the first
+		// blocker and skip filling in a hit record.
+		hit_record rec;
+		return hit(r, ray_t, rec);
+	}
+
+	virtual void hit_batch(const ray* rays, uint32_t* indices, size_t count, interval* intervals,
+						   hit_record* recs, char* did_hit) const
+	{
+		// Batched hit() over the rays rays[indices[0]] ... rays[indices[count - 1]]. Each ray k
+		// that hits within intervals[k] has intervals[k].max narrowed to the hit, recs[k]
+		// filled and did_hit[k] set; rays that miss are left untouched, so several hittables
+		// can run over one batch and keep the closest hits. The arrays are indexed by ray, not
+		// by position in `indices`, which lets aggregates pass filtered index lists down.
+		// Implementations may reorder indices[0, count) in place, so aggregates filter a batch
+		// by partitioning the caller's array rather than allocating per node.
+		// This fallback calls hit() per ray; aggregates and primitives override it to pay for
+		// virtual dispatch, node fetches and setup once per batch instead of once per ray.
+
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t k = indices[i];
+			hit_record rec;
+			if (hit(rays[k], intervals[k], rec))
+			{
+				recs[k] = rec;
+				intervals[k].max = real(rec.t);
+				did_hit[k] = 1;
+			}
+		}
+	}
+
+	size_t hit_all(const ray* rays, const interval* intervals, size_t count, std::vector<ray_hit>& hits) const
+	{
+		// Stream query: intersects the count rays in one batch and fills `hits` with one entry
+		// per ray that hit, in ray order. Returns how many there were.
+
+		std::vector<uint32_t> indices(count);
+		std::vector<interval> closest(intervals, intervals + count);
+		std::vector<hit_record> recs(count);
+		std::vector<char> did_hit(count, 0);
+		for (size_t k = 0; k < count; k++)
+		{
+			indices[k] = uint32_t(k);
+		}
+
+		hit_batch(rays, indices.data(), count, closest.data(), recs.data(), did_hit.data());
+
+		hits.clear();
+		for (size_t k = 0; k < count; k++)
+		{
+			if (did_hit[k])
+			{
+				hits.push_back({ uint32_t(k), recs[k] });
+			}
+		}
+
+		return hits.size();
+	}
+
+	virtual uint32_t hit_packet(ray_packet& packet, hit_record* recs) const
+	{
+		// Finds the closest hit of every active lane within its interval, narrowing the
+		// lane's t_max to it and filling recs[lane], and returns the mask of lanes that hit.
+		// Records of lanes that miss are left untouched. This fallback traces the lanes one
+		// at a time; hittables with a vectorized test override it.
+
+		uint32_t hits = 0;
+		for (int lane = 0; lane < ray_packet::width; lane++)
+		{
+			hit_record rec;
+			if (ray_packet::lane_set(packet.active, lane) && hit(packet.get_ray(lane), packet.get_interval(lane), rec))
+			{
+				recs[lane] = rec;
+				packet.t_max[lane] = real(rec.t);
+				hits |= (1u << lane);
+			}
+		}
+
+		return hits;
+	}
+
 	virtual double pdf_value(const point3& origin, const vec3& direction) const
 	{
+		// The density of random() directions from origin. Overrides count every surface point
+		// at t > 0, with no epsilon: shadow rays start from an offset origin, so they test
+		// (0, t) as occluded() does, and the pdf must agree with that range.
 		return 0.0;
 	}
 
-	virtual vec3 random(const point3& origin) const
+	virtual vec3 random(const point3& origin, sampler& s) const
 	{
 		return vec3(1, 0, 0);
 	}
+
+	virtual void hash_content(uint64_t& hash) const
+	{
+		// Feeds everything that decides how the object renders (geometry, materials, the
+		// objects it contains) into a scene fingerprint; see camera::scene_hash(). This
+		// fallback only knows the type and the bounds.
+		hash_type(hash, typeid(*this));
+		hash_box(hash, bounding_box());
+	}
+
+protected:
+	static void hash_box(uint64_t& hash, const aabb& box)
+	{
+		hash_values(hash, { box.x.min, box.x.max, box.y.min, box.y.max, box.z.min, box.z.max });
+	}
+
+	static void hash_vector(uint64_t& hash, const vec3& v)
+	{
+		hash_values(hash, { v.x(), v.y(), v.z() });
+	}
 };
 
 class translate : public hittable
@@ -55,10 +199,18 @@ public:
 		bbox = object->bounding_box() + offset;
 	}
 
+	// Moves the object for a new frame of an animation. A BVH containing it must then be
+	// refit or rebuilt.
+	void set_offset(const vec3& new_offset)
+	{
+		offset = new_offset;
+		bbox = object->bounding_box() + offset;
+	}
+
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override
 	{
 		// Move the ray backwards by the offset
-		ray offset_r(r.origin() - offset, r.direction(), r.time());
+		ray offset_r = r.with_origin(r.origin() - offset);
 
 		// Determine whether an intersection exists along the offset ray (and if so, where)
 		if (!object->hit(offset_r, ray_t, rec))
@@ -66,18 +218,72 @@ public:
 			return false;
 		}
 
-		// Move the intersection point forwards by the offset
-		rec.p += offset;
-
+		move_to_world_space(rec);
 		return true;
 	}
 
+	uint32_t hit_packet(ray_packet& packet, hit_record* recs) const override
+	{
+		// Move every lane backwards by the offset
+		ray_packet offset_packet = packet;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			for (int lane = 0; lane < ray_packet::width; lane++)
+			{
+				offset_packet.origin[axis][lane] -= offset[axis];
+			}
+		}
+
+		uint32_t hits = object->hit_packet(offset_packet, recs);
+		for (int lane = 0; lane < ray_packet::width; lane++)
+		{
+			if (ray_packet::lane_set(hits, lane))
+			{
+				packet.t_max[lane] = offset_packet.t_max[lane];
+				move_to_world_space(recs[lane]);
+			}
+		}
+
+		return hits;
+	}
+
+	bool occluded(const ray& r, interval ray_t) const override
+	{
+		return object->occluded(r.with_origin(r.origin() - offset), ray_t);
+	}
+
 	aabb bounding_box() const override { return bbox; }
 
+	aabb bounding_box_at(double time) const override { return object->bounding_box_at(time) + offset; }
+
+	aabb refit_bounds() override
+	{
+		bbox = object->refit_bounds() + offset;
+		return bbox;
+	}
+
+	const shared_ptr<hittable>& wrapped() const { return object; }
+
+	affine_transform object_to_world() const { return affine_transform::translation(offset); }
+
+	void hash_content(uint64_t& hash) const override
+	{
+		hash_type(hash, typeid(*this));
+		hash_vector(hash, offset);
+		object->hash_content(hash);
+	}
+
 private:
 	shared_ptr<hittable> object;
 	vec3 offset;
 	aabb bbox;
+
+	void move_to_world_space(hit_record& rec) const
+	{
+		// Move the intersection point forwards by the offset
+		rec.p += offset;
+		rec.p_error += rounding_error_bound(1) * max_abs_component(rec.p);
+	}
 };
 
 class rotate_y : public hittable
@@ -88,7 +294,102 @@ public:
 		double radians = degrees_to_radians(angle);
 		sin_theta = std::sin(radians);
 		cos_theta = std::cos(radians);
-		bbox = object->bounding_box();
+		bbox = rotated_box(object->bounding_box());
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+	{
+		ray rotated_r = to_object_space(r);
+
+		// Determine whether an intersection exists in object space (and if so, where).
+
+		if (!object->hit(rotated_r, ray_t, rec))
+		{
+			return false;
+		}
+
+		// Transform the intersection from object space back to world space.
+
+		rotate_to_world_space(rec);
+		return true;
+	}
+
+	uint32_t hit_packet(ray_packet& packet, hit_record* recs) const override
+	{
+		// Rotate every lane into object space, with the same arithmetic as to_object_space().
+		ray_packet rotated = packet;
+		for (int lane = 0; lane < ray_packet::width; lane++)
+		{
+			real x = packet.origin[0][lane];
+			real z = packet.origin[2][lane];
+			rotated.origin[0][lane] = real((cos_theta * x) - (sin_theta * z));
+			rotated.origin[2][lane] = real((sin_theta * x) + (cos_theta * z));
+
+			x = packet.direction[0][lane];
+			z = packet.direction[2][lane];
+			rotated.direction[0][lane] = real((cos_theta * x) - (sin_theta * z));
+			rotated.direction[2][lane] = real((sin_theta * x) + (cos_theta * z));
+			rotated.inv_direction[0][lane] = real(1.0 / rotated.direction[0][lane]);
+			rotated.inv_direction[2][lane] = real(1.0 / rotated.direction[2][lane]);
+		}
+
+		uint32_t hits = object->hit_packet(rotated, recs);
+		for (int lane = 0; lane < ray_packet::width; lane++)
+		{
+			if (ray_packet::lane_set(hits, lane))
+			{
+				packet.t_max[lane] = rotated.t_max[lane];
+				rotate_to_world_space(recs[lane]);
+			}
+		}
+
+		return hits;
+	}
+
+	bool occluded(const ray& r, interval ray_t) const override
+	{
+		return object->occluded(to_object_space(r), ray_t);
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	aabb bounding_box_at(double time) const override { return rotated_box(object->bounding_box_at(time)); }
+
+	aabb refit_bounds() override
+	{
+		bbox = rotated_box(object->refit_bounds());
+		return bbox;
+	}
+
+	const shared_ptr<hittable>& wrapped() const { return object; }
+
+	affine_transform object_to_world() const
+	{
+		// The rotation rotate_to_world_space() applies.
+		affine_transform result;
+		result.m[0][0] = cos_theta;
+		result.m[0][2] = sin_theta;
+		result.m[2][0] = -sin_theta;
+		result.m[2][2] = cos_theta;
+		return result;
+	}
+
+	void hash_content(uint64_t& hash) const override
+	{
+		hash_type(hash, typeid(*this));
+		hash_values(hash, { sin_theta, cos_theta });
+		object->hash_content(hash);
+	}
+
+private:
+	shared_ptr<hittable> object;
+	double sin_theta;
+	double cos_theta;
+	aabb bbox;
+
+	aabb rotated_box(const aabb& box) const
+	{
+		// Bounds of the rotated corners of an object-space box.
 
 		point3 min(infinity, infinity, infinity);
 		point3 max(-infinity, -infinity, -infinity);
@@ -99,9 +400,9 @@ public:
 			{
 				for (int k = 0; k < 2; k++)
 				{
-					double x = i * bbox.x.max + (1 - i) * bbox.x.min;
-					double y = j * bbox.y.max + (1 - j) * bbox.y.min;
-					double z = k * bbox.z.max + (1 - k) * bbox.z.min;
+					double x = i * box.x.max + (1 - i) * box.x.min;
+					double y = j * box.y.max + (1 - j) * box.y.min;
+					double z = k * box.z.max + (1 - k) * box.z.min;
 
 					double newx = cos_theta * x + sin_theta * z;
 					double newz = -sin_theta * x + cos_theta * z;
@@ -117,10 +418,10 @@ public:
 			}
 		}
 
-		bbox = aabb(min, max);
+		return aabb(min, max);
 	}
 
-	bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+	ray to_object_space(const ray& r) const
 	{
 		// Transform the ray from world space to object space.
 
@@ -132,17 +433,15 @@ public:
 							  r.direction().y(),
 							  (sin_theta * r.direction().x()) + (cos_theta * r.direction().z()));
 
-		ray rotated_r(origin, direction, r.time());
-
-		// Determine whether an intersection exists in object space (and if so, where).
-
-		if (!object->hit(rotated_r, ray_t, rec))
-		{
-			return false;
-		}
+		return ray(origin, direction, r.time());
+	}
 
-		// Transform the intersection from object space back to world space.
+	void rotate_to_world_space(hit_record& rec) const
+	{
+		// Each rotated component mixes two of the originals, and the ray was rotated the
+		// other way on the way in, so the error bound grows by both rotations.
 
+		rec.p_error = 2 * rec.p_error + rounding_error_bound(6) * 2 * max_abs_component(rec.p);
 		rec.p = point3((cos_theta * rec.p.x()) + (sin_theta * rec.p.z()),
 					   rec.p.y(),
 					   (-sin_theta * rec.p.x()) + (cos_theta * rec.p.z()));
@@ -150,17 +449,7 @@ public:
 		rec.normal = vec3((cos_theta * rec.normal.x()) + (sin_theta * rec.normal.z()),
 						  rec.normal.y(),
 						  (-sin_theta * rec.normal.x()) + (cos_theta * rec.normal.z()));
-
-		return true;
 	}
-
-	aabb bounding_box() const override { return bbox; }
-
-private:
-	shared_ptr<hittable> object;
-	double sin_theta;
-	double cos_theta;
-	aabb bbox;
 };
 
 #endif
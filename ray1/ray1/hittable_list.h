@@ -41,8 +41,75 @@ public:
         return hit_anything;
     }
 
+    void hit_batch(const ray* rays, uint32_t* indices, size_t count, interval* intervals,
+                   hit_record* recs, char* did_hit) const override
+    {
+        // One call per object for the whole batch rather than one per object per ray.
+        for (const shared_ptr<hittable>& object : objects)
+        {
+            object->hit_batch(rays, indices, count, intervals, recs, did_hit);
+        }
+    }
+
+    uint32_t hit_packet(ray_packet& packet, hit_record* recs) const override
+    {
+        // Each object narrows the t_max of the lanes it hits, so later objects only report
+        // closer hits, just as closest_so_far does in hit().
+        uint32_t hits = 0;
+        for (const shared_ptr<hittable>& object : objects)
+        {
+            hits |= object->hit_packet(packet, recs);
+        }
+
+        return hits;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        for (const shared_ptr<hittable>& object : objects)
+        {
+            if (object->occluded(r, ray_t))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
     aabb bounding_box() const override { return bbox; }
 
+    aabb bounding_box_at(double time) const override
+    {
+        aabb box;
+        for (const shared_ptr<hittable>& object : objects)
+        {
+            box = aabb(box, object->bounding_box_at(time));
+        }
+        return box;
+    }
+
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash_values(hash, { double(objects.size()) });
+        for (const shared_ptr<hittable>& object : objects)
+        {
+            object->hash_content(hash);
+        }
+    }
+
+    aabb refit_bounds() override
+    {
+        // Recomputes the box from the objects' current bounds, after some of them moved.
+        bbox = aabb();
+        for (const shared_ptr<hittable>& object : objects)
+        {
+            bbox = aabb(bbox, object->refit_bounds());
+        }
+        return bbox;
+    }
+
     double pdf_value(const point3& origin, const vec3& direction) const override
     {
         double weight = 1.0 / objects.size();
@@ -56,10 +123,10 @@ public:
         return sum;
     }
 
-    vec3 random(const point3& origin) const override
+    vec3 random(const point3& origin, sampler& s) const override
     {
         int int_size = int(objects.size());
-        return objects[random_int(0, int_size - 1)]->random(origin);
+        return objects[random_int(s, 0, int_size - 1)]->random(origin, s);
     }
 
 private:
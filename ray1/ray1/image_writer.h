@@ -0,0 +1,295 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "framebuffer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// Writers that turn a finished framebuffer into an image file. Each one assembles the whole
+// file in memory and hands it to the stream in a single write.
+//
+//   ppm_ascii   P3 text, gamma 2, 8 bits per channel (the original output)
+//   ppm_binary  P6, gamma 2, 8 bits per channel
+//   pfm         Portable float map, linear 32-bit float RGB
+//   exr         OpenEXR scanline file, linear 16-bit half RGB, uncompressed
+//
+// NaN components are written as zero in every format, as write_color always has.
+
+enum class image_format { ppm_ascii, ppm_binary, pfm, exr };
+
+namespace image_writer_detail
+{
+    inline float sanitize(float value)
+    {
+        return (value != value ? 0.0f : value);
+    }
+
+    inline void put_bytes(std::vector<char>& out, const void* bytes, size_t size)
+    {
+        const char* begin = static_cast<const char*>(bytes);
+        out.insert(out.end(), begin, begin + size);
+    }
+
+    inline void put_string(std::vector<char>& out, const std::string& text)
+    {
+        out.insert(out.end(), text.begin(), text.end());
+    }
+
+    // EXR is little-endian on disk. These write byte by byte so the host order never matters.
+
+    inline void put_u16(std::vector<char>& out, uint16_t value)
+    {
+        out.push_back(char(value & 0xff));
+        out.push_back(char(value >> 8));
+    }
+
+    inline void put_u32(std::vector<char>& out, uint32_t value)
+    {
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            out.push_back(char((value >> shift) & 0xff));
+        }
+    }
+
+    inline void put_u64(std::vector<char>& out, uint64_t value)
+    {
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            out.push_back(char((value >> shift) & 0xff));
+        }
+    }
+
+    inline void put_f32(std::vector<char>& out, float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        put_u32(out, bits);
+    }
+
+    inline void put_attribute(std::vector<char>& out, const char* name, const char* type, uint32_t size)
+    {
+        // Attribute header: name and type as null-terminated strings, then the value size.
+        put_bytes(out, name, std::strlen(name) + 1);
+        put_bytes(out, type, std::strlen(type) + 1);
+        put_u32(out, size);
+    }
+
+    inline uint16_t float_to_half(float value)
+    {
+        // IEEE 754 binary32 to binary16, rounding to nearest even. Out-of-range values become
+        // infinity and tiny ones flush through the half subnormals to zero.
+
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+
+        uint16_t sign = uint16_t((bits >> 16) & 0x8000);
+        uint32_t magnitude = bits & 0x7fffffff;
+
+        if (magnitude >= 0x7f800000)  // Infinity or NaN
+        {
+            return uint16_t(sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x0200 : 0));
+        }
+        if (magnitude >= 0x477ff000)  // 65520 and up round past the largest half
+        {
+            return uint16_t(sign | 0x7c00);
+        }
+        if (magnitude < 0x38800000)   // Below 2^-14, the smallest normal half
+        {
+            // Subnormal halves step in units of 2^-24. Rounding to 1024 carries into the
+            // smallest normal encoding on its own.
+            float units = std::fabs(value) * 16777216.0f;
+            return uint16_t(sign | uint16_t(std::nearbyint(units)));
+        }
+
+        // Rebias the exponent from 127 to 15 and keep the top 10 mantissa bits.
+        uint32_t half = (magnitude - 0x38000000) >> 13;
+        uint32_t remainder = magnitude & 0x1fff;
+        if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+        {
+            half++;
+        }
+
+        return uint16_t(sign | half);
+    }
+
+    inline bool host_is_little_endian()
+    {
+        uint16_t probe = 1;
+        unsigned char first;
+        std::memcpy(&first, &probe, 1);
+        return first == 1;
+    }
+
+    inline void encode_ppm_ascii(std::vector<char>& out, const framebuffer& image)
+    {
+        std::ostringstream text;
+        text << "P3\n" << image.width() << ' ' << image.height() << "\n255\n";
+
+        for (int j = 0; j < image.height(); ++j)
+        {
+            for (int i = 0; i < image.width(); ++i)
+            {
+                write_color(text, image.get(i, j));
+            }
+        }
+
+        put_string(out, text.str());
+    }
+
+    inline void encode_ppm_binary(std::vector<char>& out, const framebuffer& image)
+    {
+        put_string(out, "P6\n" + std::to_string(image.width()) + ' ' + std::to_string(image.height()) + "\n255\n");
+
+        const float* pixels = image.data();
+        size_t component_count = size_t(image.width()) * image.height() * 3;
+        for (size_t k = 0; k < component_count; k++)
+        {
+            out.push_back(char(to_byte(pixels[k])));
+        }
+    }
+
+    inline void encode_pfm(std::vector<char>& out, const framebuffer& image)
+    {
+        // A negative scale marks little-endian data. PFM rows run from the bottom up.
+
+        const char* scale = (host_is_little_endian() ? "-1.0" : "1.0");
+        put_string(out, "PF\n" + std::to_string(image.width()) + ' ' + std::to_string(image.height()) + '\n'
+                        + scale + '\n');
+
+        for (int j = image.height() - 1; j >= 0; --j)
+        {
+            const float* row = image.data() + size_t(j) * image.width() * 3;
+            for (int k = 0; k < image.width() * 3; k++)
+            {
+                float value = sanitize(row[k]);
+                put_bytes(out, &value, sizeof(value));
+            }
+        }
+    }
+
+    inline void encode_exr(std::vector<char>& out, const framebuffer& image)
+    {
+        // Minimal single-part scanline OpenEXR: the required header attributes, a line offset
+        // table, then one uncompressed block per row with its channels stored in name order
+        // (B, G, R).
+
+        int width = image.width();
+        int height = image.height();
+
+        put_u32(out, 20000630);  // Magic number
+        put_u32(out, 2);         // Version 2, single-part scanline
+
+        const char channel_names[3] = { 'B', 'G', 'R' };
+        put_attribute(out, "channels", "chlist", 3 * 18 + 1);
+        for (char name : channel_names)
+        {
+            out.push_back(name);
+            out.push_back('\0');
+            put_u32(out, 1);  // HALF
+            put_u32(out, 0);  // pLinear and reserved bytes
+            put_u32(out, 1);  // x sampling
+            put_u32(out, 1);  // y sampling
+        }
+        out.push_back('\0');
+
+        put_attribute(out, "compression", "compression", 1);
+        out.push_back('\0');  // NO_COMPRESSION
+
+        for (const char* window : { "dataWindow", "displayWindow" })
+        {
+            put_attribute(out, window, "box2i", 16);
+            put_u32(out, 0);
+            put_u32(out, 0);
+            put_u32(out, uint32_t(width - 1));
+            put_u32(out, uint32_t(height - 1));
+        }
+
+        put_attribute(out, "lineOrder", "lineOrder", 1);
+        out.push_back('\0');  // INCREASING_Y
+
+        put_attribute(out, "pixelAspectRatio", "float", 4);
+        put_f32(out, 1.0f);
+
+        put_attribute(out, "screenWindowCenter", "v2f", 8);
+        put_f32(out, 0.0f);
+        put_f32(out, 0.0f);
+
+        put_attribute(out, "screenWindowWidth", "float", 4);
+        put_f32(out, 1.0f);
+
+        out.push_back('\0');  // End of header
+
+        // Every block is the same size, so the offset table can be written up front.
+        uint32_t block_data_size = uint32_t(width) * 3 * sizeof(uint16_t);
+        uint64_t block_size = 8 + uint64_t(block_data_size);
+        uint64_t first_block = uint64_t(out.size()) + uint64_t(height) * 8;
+        for (int j = 0; j < height; j++)
+        {
+            put_u64(out, first_block + uint64_t(j) * block_size);
+        }
+
+        out.reserve(out.size() + size_t(block_size) * height);
+        for (int j = 0; j < height; j++)
+        {
+            put_u32(out, uint32_t(j));
+            put_u32(out, block_data_size);
+
+            for (int channel = 2; channel >= 0; channel--)
+            {
+                for (int i = 0; i < width; i++)
+                {
+                    put_u16(out, float_to_half(sanitize(image.data()[(size_t(j) * width + i) * 3 + channel])));
+                }
+            }
+        }
+    }
+}
+
+inline void write_image(std::ostream& out, const framebuffer& image, image_format format)
+{
+    std::vector<char> bytes;
+
+    switch (format)
+    {
+    case image_format::ppm_ascii:  image_writer_detail::encode_ppm_ascii(bytes, image);  break;
+    case image_format::ppm_binary: image_writer_detail::encode_ppm_binary(bytes, image); break;
+    case image_format::pfm:        image_writer_detail::encode_pfm(bytes, image);        break;
+    case image_format::exr:        image_writer_detail::encode_exr(bytes, image);        break;
+    }
+
+    out.write(bytes.data(), std::streamsize(bytes.size()));
+    out.flush();
+}
+
+inline bool write_image(const std::string& filename, const framebuffer& image, image_format format)
+{
+    std::ofstream file(filename, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "ERROR: Could not open image file '" << filename << "' for writing.\n";
+        return false;
+    }
+
+    write_image(file, image, format);
+    return bool(file);
+}
+
+inline void set_binary_stdout()
+{
+    // Binary images piped to standard output must not go through newline translation.
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "affine.h"
+#include "hittable.h"
+#include "material.h"
+#include "transform.h"
+
+class instance : public transform
+{
+public:
+    // One placement of shared geometry. The geometry (the bottom-level structure, usually
+    // a bvh_node over one mesh or group, built once) is referenced, not copied, and seen
+    // through an affine object-to-world transform, optionally with its material replaced.
+    // A bvh_node over a list of instances is the top-level structure. Refitting it has each
+    // instance re-read its geometry's current bounds but never refits the geometry itself,
+    // which may be shared by many instances: after moving primitives inside a bottom-level
+    // tree, refit that tree first, then the top level. Moving an instance (set_transform)
+    // only needs the top level refit or rebuilt.
+
+    instance(shared_ptr<hittable> geometry, const affine_transform& object_to_world,
+             shared_ptr<material> material_override = nullptr)
+        : transform(geometry, object_to_world), material_override(material_override)
+    {
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (!transform::hit(r, ray_t, rec))
+        {
+            return false;
+        }
+
+        override_material(rec);
+        return true;
+    }
+
+    aabb refit_bounds() override
+    {
+        set_transform(object_to_world());
+        return bounding_box();
+    }
+
+    uint32_t hit_packet(ray_packet& packet, hit_record* recs) const override
+    {
+        uint32_t hits = transform::hit_packet(packet, recs);
+        for (int lane = 0; lane < ray_packet::width; lane++)
+        {
+            if (ray_packet::lane_set(hits, lane))
+            {
+                override_material(recs[lane]);
+            }
+        }
+        return hits;
+    }
+
+    void hash_content(uint64_t& hash) const override
+    {
+        transform::hash_content(hash);
+        hash_material(hash, material_override.get());
+    }
+
+private:
+    shared_ptr<material> material_override;
+
+    void override_material(hit_record& rec) const
+    {
+        if (material_override)
+        {
+            rec.mat = material_override.get();
+        }
+    }
+};
+
+#endif
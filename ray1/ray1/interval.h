@@ -4,11 +4,11 @@
 class interval
 {
 public:
-    double min, max;
+    real min, max;
 
     interval() : min(+infinity), max(-infinity) {} // Default interval is empty
 
-    interval(double min, double max) : min(min), max(max) {}
+    interval(real min, real max) : min(min), max(max) {}
 
     interval(const interval& a, const interval& b)
     {
@@ -17,31 +17,31 @@ public:
         max = (a.max >= b.max ? a.max : b.max);
     }
 
-    double size() const
+    real size() const
     {
         return max - min;
     }
 
-    bool contains(double x) const
+    bool contains(real x) const
     {
         return (min <= x && x <= max);
     }
 
-    bool surrounds(double x) const
+    bool surrounds(real x) const
     {
         return (min < x && x < max);
     }
 
-    double clamp(double x) const
+    real clamp(real x) const
     {
         if (x < min) return min;
         if (x > max) return max;
         return x;
     }
 
-    interval expand(double delta) const
+    interval expand(real delta) const
     {
-        double padding = delta / 2;
+        real padding = delta / 2;
         return interval(min - padding, max + padding);
     }
 
@@ -51,12 +51,12 @@ public:
 const interval interval::empty = interval(+infinity, -infinity);
 const interval interval::universe = interval(-infinity, +infinity);
 
-interval operator+(const interval& ival, double displacement)
+interval operator+(const interval& ival, real displacement)
 {
     return interval(ival.min + displacement, ival.max + displacement);
 }
 
-interval operator+(double displacement, const interval& ival)
+interval operator+(real displacement, const interval& ival)
 {
     return ival + displacement;
 }
@@ -0,0 +1,410 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+
+#include <cstdint>
+#include <vector>
+
+struct alignas(32) linear_bvh_node
+{
+    // One node of a flattened BVH, packed into 32 bytes so two nodes share a cache line.
+    // Nodes are stored in depth-first order: an interior node's first child immediately
+    // follows it and `offset` holds the index of its second child. For a leaf, `offset` is
+    // the first entry of its primitive range. An interior node's first child holds the
+    // primitives lower along `split_axis`, which lets traversal visit the near child first.
+
+    float    bounds_min[3];
+    float    bounds_max[3];
+    uint32_t offset;
+    uint16_t primitive_count;  // Zero for interior nodes
+    uint8_t  split_axis;
+    uint8_t  padding;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node must stay 32 bytes");
+
+struct bvh_traversal_stats
+{
+    // Work done by closest-hit traversals, summed over rays by count_traversal().
+
+    size_t rays = 0;
+    size_t node_visits = 0;      // Nodes fetched
+    size_t box_tests = 0;        // Child boxes tested; a wide node tests all of its slots at once
+    size_t primitive_tests = 0;  // Calls into leaf primitives
+};
+
+inline float round_down_to_float(double value)
+{
+    // Narrow to float without shrinking a box.
+    float f = float(value);
+    return (double(f) > value ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f);
+}
+
+inline float round_up_to_float(double value)
+{
+    float f = float(value);
+    return (double(f) < value ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f);
+}
+
+class linear_bvh : public hittable
+{
+public:
+    // Deepest interior chain the traversal stack can hold. Builders collapse anything deeper
+    // into a leaf, which only happens for pathological trees.
+    static const int max_depth = 64;
+
+    linear_bvh() {}
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        return closest_hit<false>(r, ray_t, rec, nullptr);
+    }
+
+    void count_traversal(const ray& r, interval ray_t, bvh_traversal_stats& stats) const
+    {
+        hit_record rec;
+        closest_hit<true>(r, ray_t, rec, &stats);
+        stats.rays++;
+    }
+
+    void hit_batch(const ray* rays, uint32_t* indices, size_t count, interval* intervals,
+                   hit_record* recs, char* did_hit) const override
+    {
+        // Streams the whole batch through the tree: each node keeps the rays that reach its
+        // box and passes only those on, so every node is fetched once per batch.
+
+        if (nodes.empty())
+        {
+            return;
+        }
+
+        stream_node(0, indices, count, rays, intervals, recs, did_hit);
+    }
+
+    uint32_t hit_packet(ray_packet& packet, hit_record* recs) const override
+    {
+        // Walks the tree once for the whole packet. Each node is tested against every lane
+        // still active at it, and the packet descends while any lane hits the node's box;
+        // leaves run the primitives' packet tests on just those lanes.
+
+        if (nodes.empty())
+        {
+            return 0;
+        }
+
+        uint32_t entry_active = packet.active;
+        uint32_t hits = 0;
+
+        uint32_t stack[max_depth];
+        uint32_t stack_masks[max_depth];  // Lanes that reached the parent of each pushed node
+        int stack_size = 0;
+        uint32_t current = 0;
+        uint32_t mask = entry_active;
+
+        while (true)
+        {
+            const linear_bvh_node& node = nodes[current];
+            mask = node_hit_packet(node, packet, mask);
+
+            if (mask != 0)
+            {
+                if (node.primitive_count > 0)
+                {
+                    packet.active = mask;
+                    for (uint32_t i = 0; i < node.primitive_count; i++)
+                    {
+                        hits |= primitives[node.offset + i]->hit_packet(packet, recs);
+                    }
+                }
+                else
+                {
+                    stack[stack_size] = node.offset;
+                    stack_masks[stack_size++] = mask;
+                    current = current + 1;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0)
+            {
+                break;
+            }
+            current = stack[--stack_size];
+            mask = stack_masks[stack_size];
+        }
+
+        packet.active = entry_active;
+        return hits;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        uint32_t stack[max_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+
+        while (true)
+        {
+            const linear_bvh_node& node = nodes[current];
+
+            if (node_hit(node, r, ray_t.min, ray_t.max))
+            {
+                if (node.primitive_count == 0)
+                {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                    continue;
+                }
+
+                for (uint32_t i = 0; i < node.primitive_count; i++)
+                {
+                    if (primitives[node.offset + i]->occluded(r, ray_t))
+                    {
+                        return true;
+                    }
+                }
+            }
+
+            if (stack_size == 0)
+            {
+                return false;
+            }
+            current = stack[--stack_size];
+        }
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash_values(hash, { double(owners.size()) });
+        for (const shared_ptr<hittable>& object : owners)
+        {
+            object->hash_content(hash);
+        }
+    }
+
+    size_t node_count() const { return nodes.size(); }
+    size_t node_bytes() const { return sizeof(linear_bvh_node); }
+    size_t primitive_count() const { return primitives.size(); }
+
+    // Builder interface: append nodes in depth-first order.
+
+    uint32_t add_interior(const aabb& box, int split_axis)
+    {
+        uint32_t index = push_node(box);
+        nodes[index].primitive_count = 0;
+        nodes[index].split_axis = uint8_t(split_axis);
+        return index;
+    }
+
+    void set_second_child(uint32_t interior, uint32_t child)
+    {
+        nodes[interior].offset = child;
+    }
+
+    uint32_t add_leaf(const aabb& box, const std::vector<shared_ptr<hittable>>& leaf_objects)
+    {
+        uint32_t index = push_node(box);
+        nodes[index].offset = uint32_t(primitives.size());
+        nodes[index].primitive_count = uint16_t(leaf_objects.size());
+
+        for (const shared_ptr<hittable>& object : leaf_objects)
+        {
+            primitives.push_back(object.get());
+            owners.push_back(object);
+        }
+
+        return index;
+    }
+
+private:
+    std::vector<linear_bvh_node> nodes;
+    std::vector<const hittable*> primitives;      // Raw pointers, so leaves never touch refcounts
+    std::vector<shared_ptr<hittable>> owners;     // Keeps the primitives alive
+    aabb bbox;
+
+    uint32_t push_node(const aabb& box)
+    {
+        if (nodes.empty())
+        {
+            bbox = box;
+        }
+
+        linear_bvh_node node = {};
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const interval& extent = box.axis_interval(axis);
+            node.bounds_min[axis] = round_down_to_float(extent.min);
+            node.bounds_max[axis] = round_up_to_float(extent.max);
+        }
+
+        nodes.push_back(node);
+        return uint32_t(nodes.size() - 1);
+    }
+
+    template<bool count_steps>
+    bool closest_hit(const ray& r, interval ray_t, hit_record& rec, bvh_traversal_stats* stats) const
+    {
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        bool hit_anything = false;
+        double closest_so_far = ray_t.max;
+
+        uint32_t stack[max_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+
+        while (true)
+        {
+            const linear_bvh_node& node = nodes[current];
+            if (count_steps)
+            {
+                stats->node_visits++;
+                stats->box_tests++;
+            }
+
+            if (node_hit(node, r, ray_t.min, closest_so_far))
+            {
+                if (node.primitive_count > 0)
+                {
+                    for (uint32_t i = 0; i < node.primitive_count; i++)
+                    {
+                        if (primitives[node.offset + i]->hit(r, interval(ray_t.min, closest_so_far), rec))
+                        {
+                            hit_anything = true;
+                            closest_so_far = rec.t;
+                        }
+                    }
+                    if (count_steps)
+                    {
+                        stats->primitive_tests += node.primitive_count;
+                    }
+                }
+                else
+                {
+                    // Descend into the near child and defer the far one. By the time the far
+                    // child is popped, its box test runs against the closest hit found so
+                    // far and skips it if it starts beyond that hit.
+                    bool second_first = r.dir_sign(node.split_axis);
+                    stack[stack_size++] = (second_first ? current + 1 : node.offset);
+                    current = (second_first ? node.offset : current + 1);
+                    continue;
+                }
+            }
+
+            if (stack_size == 0)
+            {
+                break;
+            }
+            current = stack[--stack_size];
+        }
+
+        return hit_anything;
+    }
+
+    static bool node_hit(const linear_bvh_node& node, const ray& r, double t_min, double t_max)
+    {
+        // The same branchless slab test as aabb::hit, using the ray's cached inverse direction
+        // and signs to pick each slab's near and far plane.
+
+        const point3& orig = r.origin();
+        const vec3& inv_dir = r.inv_direction();
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            int sign = r.dir_sign(axis);
+            double t_near = ((sign ? node.bounds_max[axis] : node.bounds_min[axis]) - orig[axis]) * inv_dir[axis];
+            double t_far = ((sign ? node.bounds_min[axis] : node.bounds_max[axis]) - orig[axis]) * inv_dir[axis];
+
+            t_min = (t_near > t_min ? t_near : t_min);
+            t_max = (t_far < t_max ? t_far : t_max);
+        }
+
+        return t_min < t_max;
+    }
+
+    void stream_node(uint32_t index, uint32_t* indices, size_t count, const ray* rays, interval* intervals,
+                     hit_record* recs, char* did_hit) const
+    {
+        // The rays reaching the parent are indices[0, count). The ones that also reach this
+        // node are swapped to the front and that prefix is visited, so the whole traversal
+        // works in the caller's array. Children only reorder within the prefix they get.
+
+        const linear_bvh_node& node = nodes[index];
+
+        size_t reaching = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            uint32_t k = indices[i];
+            if (node_hit(node, rays[k], intervals[k].min, intervals[k].max))
+            {
+                indices[i] = indices[reaching];
+                indices[reaching++] = k;
+            }
+        }
+
+        if (reaching > 0)
+        {
+            if (node.primitive_count > 0)
+            {
+                for (uint32_t i = 0; i < node.primitive_count; i++)
+                {
+                    primitives[node.offset + i]->hit_batch(rays, indices, reaching, intervals, recs, did_hit);
+                }
+            }
+            else
+            {
+                stream_node(index + 1, indices, reaching, rays, intervals, recs, did_hit);
+                stream_node(node.offset, indices, reaching, rays, intervals, recs, did_hit);
+            }
+        }
+    }
+
+    static uint32_t node_hit_packet(const linear_bvh_node& node, const ray_packet& packet, uint32_t mask)
+    {
+        // node_hit() for a group of lanes per SIMD register, returning the lanes of `mask`
+        // that hit the box.
+
+        using namespace packet_simd;
+
+        uint32_t result = 0;
+        for (int group = 0; group < ray_packet::width; group += lanes)
+        {
+            lanes_t t_min = load(packet.t_min + group);
+            lanes_t t_max = load(packet.t_max + group);
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                lanes_t inv_dir = load(packet.inv_direction[axis] + group);
+                lanes_t origin = load(packet.origin[axis] + group);
+                lanes_t bounds_min = broadcast(node.bounds_min[axis]);
+                lanes_t bounds_max = broadcast(node.bounds_max[axis]);
+
+                auto negative = less(inv_dir, broadcast(0));
+                lanes_t t_near = mul(sub(select(negative, bounds_max, bounds_min), origin), inv_dir);
+                lanes_t t_far = mul(sub(select(negative, bounds_min, bounds_max), origin), inv_dir);
+
+                t_min = max(t_near, t_min);
+                t_max = min(t_far, t_max);
+            }
+
+            result |= bits(less(t_min, t_max)) << group;
+        }
+
+        return result & mask;
+    }
+};
+
+#endif
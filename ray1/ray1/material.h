@@ -9,7 +9,7 @@ class scatter_record
 {
 public:
     color attenuation;
-    shared_ptr<pdf> pdf_ptr;
+    material_pdf pdf;         // Held by value, so scattering never allocates
     bool skip_pdf;
     ray skip_pdf_ray;
 };
@@ -24,7 +24,7 @@ public:
         return color(0, 0, 0);
     }
 
-	virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const
+	virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec, sampler& s) const
 	{
 		return false;
 	}
@@ -33,18 +33,37 @@ public:
     {
         return 0;
     }
+
+    virtual void hash_content(uint64_t& hash) const
+    {
+        // Feeds the material's parameters into a scene fingerprint; see hittable::hash_content().
+        hash_type(hash, typeid(*this));
+    }
 };
 
+inline void hash_material(uint64_t& hash, const material* mat)
+{
+    // Geometry that only stands in for a light when sampling carries no material.
+    if (mat)
+    {
+        mat->hash_content(hash);
+    }
+    else
+    {
+        hash_values(hash, { 0.0 });
+    }
+}
+
 class lambertian : public material
 {
 public:
     lambertian(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
     lambertian(shared_ptr<texture> tex) : tex(tex) {}
 
-    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
+    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec, sampler& s) const override
     {
         srec.attenuation = tex->value(rec.u, rec.v, rec.p);
-        srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+        srec.pdf = cosine_pdf(rec.normal);
         srec.skip_pdf = false;
         return true;
     }
@@ -55,6 +74,12 @@ public:
         return (cos_theta < 0 ? 0 : cos_theta / pi);
     }
 
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        tex->hash_content(hash);
+    }
+
 private:
     shared_ptr<texture> tex;
 };
@@ -67,19 +92,24 @@ public:
         fuzz(fuzz < 1 ? fuzz : 1) 
     { }
 
-    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
+    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec, sampler& s) const override
     {
         vec3 reflected = reflect(r_in.direction(), rec.normal);
-        reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
+        reflected = unit_vector(reflected) + (fuzz * random_unit_vector(s));
         
         srec.attenuation = albedo;
-        srec.pdf_ptr = nullptr;
         srec.skip_pdf = true;
-        srec.skip_pdf_ray = ray(rec.p, reflected, r_in.time());
+        srec.skip_pdf_ray = rec.spawn_ray(reflected, r_in.time());
 
         return true;
     }
 
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash_values(hash, { albedo.x(), albedo.y(), albedo.z(), fuzz });
+    }
+
 private:
     color albedo;
     double fuzz;
@@ -90,10 +120,9 @@ class dielectric : public material
 public:
     dielectric(double refraction_index) : refraction_index(refraction_index) {}
 
-    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
+    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec, sampler& s) const override
     {
         srec.attenuation = color(1.0, 1.0, 1.0);
-        srec.pdf_ptr = nullptr;
         srec.skip_pdf = true;
         double ri = (rec.front_face ? (1.0 / refraction_index) : refraction_index);
 
@@ -104,7 +133,7 @@ public:
         bool cannot_refract = (ri * sin_theta > 1.0);
         vec3 direction;
 
-        if (cannot_refract || reflectance(cos_theta, ri) > random_double())
+        if (cannot_refract || reflectance(cos_theta, ri) > random_double(s))
         {
             direction = reflect(unit_direction, rec.normal);
         }
@@ -113,10 +142,16 @@ public:
             direction = refract(unit_direction, rec.normal, ri);
         }
 
-        srec.skip_pdf_ray = ray(rec.p, direction, r_in.time());
+        srec.skip_pdf_ray = rec.spawn_ray(direction, r_in.time());
         return true;
     }
 
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash_values(hash, { refraction_index });
+    }
+
 private:
     // Refractive index in vacuum or air, or the ratio of the material's refractive index over
     // the refractive index of the enclosing media
@@ -146,6 +181,12 @@ public:
         return tex->value(u, v, p);
     }
 
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        tex->hash_content(hash);
+    }
+
 private:
     shared_ptr<texture> tex;
 };
@@ -156,10 +197,10 @@ public:
     isotropic(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
     isotropic(shared_ptr<texture> tex) : tex(tex) {}
 
-    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override
+    bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec, sampler& s) const override
     {
         srec.attenuation = tex->value(rec.u, rec.v, rec.p);
-        srec.pdf_ptr = make_shared<sphere_pdf>();
+        srec.pdf = sphere_pdf();
         srec.skip_pdf = false;
         return true;
     }
@@ -169,6 +210,11 @@ public:
         return 1 / (4 * pi);
     }
 
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        tex->hash_content(hash);
+    }
 
 private:
     shared_ptr<texture> tex;
@@ -0,0 +1,261 @@
+#ifndef MOTION_BVH_H
+#define MOTION_BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+struct alignas(64) motion_bvh_node
+{
+    // One node of a flattened motion BVH: a linear_bvh_node whose box moves linearly from
+    // shutter open (time 0) to shutter close (time 1), stored as the box at time 0 plus the
+    // motion of each plane over the interval. A ray tests the box at its own time, which
+    // bounds linearly moving primitives about as tightly as a static tree bounds static
+    // ones; a static tree has to bound them over the whole shutter interval instead.
+
+    float    bounds_min[3];
+    float    bounds_max[3];
+    float    motion_min[3];  // Rounded so that the box at every time still contains the primitives
+    float    motion_max[3];
+    uint32_t offset;
+    uint16_t primitive_count;  // Zero for interior nodes
+    uint8_t  split_axis;
+    uint8_t  padding;
+};
+
+static_assert(sizeof(motion_bvh_node) == 64, "motion_bvh_node must stay one cache line");
+
+class motion_bvh : public hittable
+{
+public:
+    static const int max_depth = linear_bvh::max_depth;
+
+    motion_bvh() {}
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        return closest_hit<false>(r, ray_t, rec, nullptr);
+    }
+
+    void count_traversal(const ray& r, interval ray_t, bvh_traversal_stats& stats) const
+    {
+        hit_record rec;
+        closest_hit<true>(r, ray_t, rec, &stats);
+        stats.rays++;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        uint32_t stack[max_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+
+        while (true)
+        {
+            const motion_bvh_node& node = nodes[current];
+
+            if (node_hit(node, r, ray_t.min, ray_t.max))
+            {
+                if (node.primitive_count == 0)
+                {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                    continue;
+                }
+
+                for (uint32_t i = 0; i < node.primitive_count; i++)
+                {
+                    if (primitives[node.offset + i]->occluded(r, ray_t))
+                    {
+                        return true;
+                    }
+                }
+            }
+
+            if (stack_size == 0)
+            {
+                return false;
+            }
+            current = stack[--stack_size];
+        }
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    aabb bounding_box_at(double time) const override { return (nodes.empty() ? aabb() : node_box(nodes[0], time)); }
+
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash_values(hash, { double(owners.size()) });
+        for (const shared_ptr<hittable>& object : owners)
+        {
+            object->hash_content(hash);
+        }
+    }
+
+    size_t node_count() const { return nodes.size(); }
+    size_t node_bytes() const { return sizeof(motion_bvh_node); }
+    size_t primitive_count() const { return primitives.size(); }
+
+    // Builder interface: append nodes in depth-first order, then give each its boxes.
+
+    uint32_t add_interior(int split_axis)
+    {
+        nodes.push_back(motion_bvh_node());
+        nodes.back().split_axis = uint8_t(split_axis);
+        return uint32_t(nodes.size() - 1);
+    }
+
+    void set_second_child(uint32_t interior, uint32_t child)
+    {
+        nodes[interior].offset = child;
+    }
+
+    uint32_t add_leaf(const std::vector<shared_ptr<hittable>>& leaf_objects)
+    {
+        nodes.push_back(motion_bvh_node());
+        nodes.back().offset = uint32_t(primitives.size());
+        nodes.back().primitive_count = uint16_t(leaf_objects.size());
+
+        for (const shared_ptr<hittable>& object : leaf_objects)
+        {
+            primitives.push_back(object.get());
+            owners.push_back(object);
+        }
+
+        return uint32_t(nodes.size() - 1);
+    }
+
+    void set_bounds(uint32_t index, const aabb& box_open, const aabb& box_close)
+    {
+        motion_bvh_node& node = nodes[index];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const interval& open = box_open.axis_interval(axis);
+            const interval& close = box_close.axis_interval(axis);
+            node.bounds_min[axis] = round_down_to_float(open.min);
+            node.bounds_max[axis] = round_up_to_float(open.max);
+            node.motion_min[axis] = round_down_to_float(close.min - node.bounds_min[axis]);
+            node.motion_max[axis] = round_up_to_float(close.max - node.bounds_max[axis]);
+        }
+
+        if (index == 0)
+        {
+            bbox = aabb(box_open, box_close);
+        }
+    }
+
+private:
+    std::vector<motion_bvh_node> nodes;
+    std::vector<const hittable*> primitives;      // Raw pointers, so leaves never touch refcounts
+    std::vector<shared_ptr<hittable>> owners;     // Keeps the primitives alive
+    aabb bbox;
+
+    template<bool count_steps>
+    bool closest_hit(const ray& r, interval ray_t, hit_record& rec, bvh_traversal_stats* stats) const
+    {
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        bool hit_anything = false;
+        double closest_so_far = ray_t.max;
+
+        uint32_t stack[max_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+
+        while (true)
+        {
+            const motion_bvh_node& node = nodes[current];
+            if (count_steps)
+            {
+                stats->node_visits++;
+                stats->box_tests++;
+            }
+
+            if (node_hit(node, r, ray_t.min, closest_so_far))
+            {
+                if (node.primitive_count > 0)
+                {
+                    for (uint32_t i = 0; i < node.primitive_count; i++)
+                    {
+                        if (primitives[node.offset + i]->hit(r, interval(ray_t.min, closest_so_far), rec))
+                        {
+                            hit_anything = true;
+                            closest_so_far = rec.t;
+                        }
+                    }
+                    if (count_steps)
+                    {
+                        stats->primitive_tests += node.primitive_count;
+                    }
+                }
+                else
+                {
+                    // Near child first, as in linear_bvh.
+                    bool second_first = r.dir_sign(node.split_axis);
+                    stack[stack_size++] = (second_first ? current + 1 : node.offset);
+                    current = (second_first ? node.offset : current + 1);
+                    continue;
+                }
+            }
+
+            if (stack_size == 0)
+            {
+                break;
+            }
+            current = stack[--stack_size];
+        }
+
+        return hit_anything;
+    }
+
+    static bool node_hit(const motion_bvh_node& node, const ray& r, double t_min, double t_max)
+    {
+        // linear_bvh's slab test against the node's box at the ray's time.
+
+        const point3& orig = r.origin();
+        const vec3& inv_dir = r.inv_direction();
+        double time = r.time();
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            double lower = node.bounds_min[axis] + time * node.motion_min[axis];
+            double upper = node.bounds_max[axis] + time * node.motion_max[axis];
+
+            int sign = r.dir_sign(axis);
+            double t_near = ((sign ? upper : lower) - orig[axis]) * inv_dir[axis];
+            double t_far = ((sign ? lower : upper) - orig[axis]) * inv_dir[axis];
+
+            t_min = (t_near > t_min ? t_near : t_min);
+            t_max = (t_far < t_max ? t_far : t_max);
+        }
+
+        return t_min < t_max;
+    }
+
+    static aabb node_box(const motion_bvh_node& node, double time)
+    {
+        interval extents[3];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            double lower = node.bounds_min[axis] + time * node.motion_min[axis];
+            double upper = node.bounds_max[axis] + time * node.motion_max[axis];
+            extents[axis] = interval(lower, upper);
+        }
+        return aabb(extents[0], extents[1], extents[2]);
+    }
+};
+
+#endif
@@ -0,0 +1,252 @@
+#ifndef ORIENTED_BOX_H
+#define ORIENTED_BOX_H
+
+#include "affine.h"
+#include "hittable.h"
+#include "material.h"
+
+class oriented_box : public hittable
+{
+public:
+    // A solid box (in general a parallelepiped) spanned by three edges from one corner. The
+    // ray is mapped into the box's unit-cube frame and intersected with a single slab test,
+    // where box() used to run six quad intersections through six virtual calls. Faces, their
+    // normals and their UVs match the six quads box() builds for an axis-aligned box.
+
+    oriented_box(const point3& corner, const vec3& edge_u, const vec3& edge_v, const vec3& edge_w,
+                 shared_ptr<material> mat)
+        : corner(corner), mat(mat)
+    {
+        edges[0] = edge_u;
+        edges[1] = edge_v;
+        edges[2] = edge_w;
+
+        for (int i = 0; i < 3; i++)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                to_world.m[i][axis] = edges[axis][i];
+            }
+            to_world.m[i][3] = corner[i];
+        }
+        to_unit = to_world.inverse();
+
+        // The outward normal of the far face along each axis; the near face's is its negation.
+        // These go through the inverse transpose, so they point outward whatever the edges.
+        area = 0;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            vec3 unit_normal(axis == 0, axis == 1, axis == 2);
+            normals[axis] = unit_vector(to_unit.apply_transposed(unit_normal));
+            face_areas[axis] = cross(edges[(axis + 1) % 3], edges[(axis + 2) % 3]).length();
+            area += 2 * face_areas[axis];
+        }
+
+        // Coordinates make a round trip through the unit frame, so their errors grow with
+        // the conditioning of the edge matrix as well as with their magnitude.
+        error_scale = to_world.linear_norm() * to_unit.linear_norm();
+
+        bbox = to_world.apply_box(aabb(point3(0, 0, 0), point3(1, 1, 1)));
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        slab_crossings crossings;
+        if (!find_crossings(r, crossings))
+        {
+            return false;
+        }
+
+        // The entry face for rays arriving from outside, the exit face for rays inside.
+        double t;
+        int face;
+        if (ray_t.contains(crossings.t_enter))
+        {
+            t = crossings.t_enter;
+            face = crossings.enter_face;
+        }
+        else if (ray_t.contains(crossings.t_exit))
+        {
+            t = crossings.t_exit;
+            face = crossings.exit_face;
+        }
+        else
+        {
+            return false;
+        }
+
+        set_hit_record(r, t, face, crossings.origin + t * crossings.direction, rec);
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        slab_crossings crossings;
+        return find_crossings(r, crossings)
+            && (ray_t.contains(crossings.t_enter) || ray_t.contains(crossings.t_exit));
+    }
+
+    shared_ptr<oriented_box> transformed(const affine_transform& object_to_world) const
+    {
+        // Affine maps take parallelepipeds to parallelepipeds, so this is exact for any
+        // invertible transform, mirroring ones included.
+        return make_shared<oriented_box>(object_to_world.apply_point(corner), object_to_world.apply_vector(edges[0]),
+                                         object_to_world.apply_vector(edges[1]), object_to_world.apply_vector(edges[2]), mat);
+    }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override
+    {
+        // random() picks points uniformly over the whole surface, faces turned away from the
+        // origin included, so every surface point ahead of the origin contributes.
+
+        slab_crossings crossings;
+        if (!find_crossings(ray(origin, direction), crossings))
+        {
+            return 0;
+        }
+
+        double length_squared = direction.length_squared();
+        double length = std::sqrt(length_squared);
+        double pdf = 0;
+
+        double ts[2] = { crossings.t_enter, crossings.t_exit };
+        int faces[2] = { crossings.enter_face, crossings.exit_face };
+        for (int i = 0; i < 2; i++)
+        {
+            if (ts[i] > 0)
+            {
+                double distance_squared = ts[i] * ts[i] * length_squared;
+                double cosine = std::fabs(dot(direction, normals[faces[i] / 2]) / length);
+                pdf += distance_squared / (cosine * area);
+            }
+        }
+
+        return pdf;
+    }
+
+    vec3 random(const point3& origin, sampler& s) const override
+    {
+        // Picks a face with probability proportional to its area, then a point on it.
+
+        double pick = random_double(s) * area;
+        double a = random_double(s);
+        double b = random_double(s);
+
+        int axis = 0;
+        while (axis < 2 && pick >= 2 * face_areas[axis])
+        {
+            pick -= 2 * face_areas[axis];
+            axis++;
+        }
+
+        point3 local;
+        local[axis] = (pick >= face_areas[axis] ? 1 : 0);
+        local[(axis + 1) % 3] = a;
+        local[(axis + 2) % 3] = b;
+
+        return to_world.apply_point(local) - origin;
+    }
+
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash_vector(hash, corner);
+        for (const vec3& edge : edges)
+        {
+            hash_vector(hash, edge);
+        }
+        hash_material(hash, mat.get());
+    }
+
+private:
+    struct slab_crossings
+    {
+        // Where the ray's line enters and leaves the box. Faces are numbered 2 * axis + side,
+        // side 1 being the face at unit coordinate 1.
+        double t_enter, t_exit;
+        int enter_face, exit_face;
+        point3 origin;   // The ray in the unit-cube frame
+        vec3 direction;
+    };
+
+    point3 corner;
+    vec3 edges[3];
+    shared_ptr<material> mat;
+    affine_transform to_world;  // Unit cube to world
+    affine_transform to_unit;
+    vec3 normals[3];
+    double face_areas[3];
+    double area;
+    double error_scale;
+    aabb bbox;
+
+    bool find_crossings(const ray& r, slab_crossings& crossings) const
+    {
+        // The slab test of aabb::hit() against the unit cube, keeping which slab bounds each
+        // end. The direction is not renormalized, so t means the same as in world space.
+
+        crossings.origin = to_unit.apply_point(r.origin());
+        crossings.direction = to_unit.apply_vector(r.direction());
+        crossings.t_enter = -infinity;
+        crossings.t_exit = infinity;
+        crossings.enter_face = 0;
+        crossings.exit_face = 0;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            double inv_dir = 1 / crossings.direction[axis];
+            bool reversed = std::signbit(inv_dir);
+            double t0 = (0 - crossings.origin[axis]) * inv_dir;
+            double t1 = (1 - crossings.origin[axis]) * inv_dir;
+            double t_near = (reversed ? t1 : t0);
+            double t_far = (reversed ? t0 : t1);
+
+            // A NaN (a ray lying in a slab plane) fails both comparisons and is ignored.
+            if (t_near > crossings.t_enter)
+            {
+                crossings.t_enter = t_near;
+                crossings.enter_face = 2 * axis + reversed;
+            }
+            if (t_far < crossings.t_exit)
+            {
+                crossings.t_exit = t_far;
+                crossings.exit_face = 2 * axis + !reversed;
+            }
+        }
+
+        return crossings.t_enter < crossings.t_exit;
+    }
+
+    void set_hit_record(const ray& r, double t, int face, const point3& local, hit_record& rec) const
+    {
+        int axis = face / 2;
+        bool far_side = (face % 2 == 1);
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.p_error = rounding_error_bound(12) * error_scale
+                    * (max_abs_component(r.origin()) + max_abs_component(rec.p) + max_abs_component(corner));
+        rec.mat = mat.get();
+        rec.set_face_normal(r, far_side ? normals[axis] : -normals[axis]);
+
+        // The UVs of the matching quad from box(): a, b, c are the unit coordinates along
+        // the x, y and z edges there.
+        interval unit_interval(0, 1);
+        double a = unit_interval.clamp(local.x());
+        double b = unit_interval.clamp(local.y());
+        double c = unit_interval.clamp(local.z());
+        switch (face)
+        {
+            case 0:  rec.u = c;     rec.v = b;     break;  // left
+            case 1:  rec.u = 1 - c; rec.v = b;     break;  // right
+            case 2:  rec.u = a;     rec.v = c;     break;  // bottom
+            case 3:  rec.u = a;     rec.v = 1 - c; break;  // top
+            case 4:  rec.u = 1 - a; rec.v = b;     break;  // back
+            default: rec.u = a;     rec.v = b;     break;  // front
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class work_stealing_queue
+{
+public:
+    // A task deque owned by one worker. The owner takes work from the front, while idle
+    // workers steal from the back, so a thief grabs the work furthest from what the owner
+    // is currently touching.
+
+    void push(int task)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(task);
+    }
+
+    bool pop(int& task)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tasks.empty())
+        {
+            return false;
+        }
+
+        task = tasks.front();
+        tasks.pop_front();
+        return true;
+    }
+
+    bool steal(int& task)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tasks.empty())
+        {
+            return false;
+        }
+
+        task = tasks.back();
+        tasks.pop_back();
+        return true;
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<int> tasks;
+};
+
+inline int resolve_thread_count(int requested)
+{
+    // Returns the number of workers to use for a requested count, where zero or less means
+    // one worker per hardware thread.
+
+    if (requested > 0)
+    {
+        return requested;
+    }
+
+    int hardware = int(std::thread::hardware_concurrency());
+    return (hardware > 0 ? hardware : 1);
+}
+
+template <typename Func>
+void parallel_for(int task_count, int thread_count, const Func& func)
+{
+    // Runs func(task, worker) for every task index in [0, task_count) on thread_count workers.
+    // Each worker starts with a contiguous block of tasks in its own deque and steals from the
+    // others once its block runs dry. No tasks are added after startup, so a worker that finds
+    // every deque empty can safely retire. The calling thread acts as worker zero.
+
+    if (task_count <= 0)
+    {
+        return;
+    }
+
+    int worker_count = std::min(resolve_thread_count(thread_count), task_count);
+    std::vector<work_stealing_queue> queues(worker_count);
+
+    for (int worker = 0; worker < worker_count; worker++)
+    {
+        int first = int((long long)task_count * worker / worker_count);
+        int last = int((long long)task_count * (worker + 1) / worker_count);
+        for (int task = first; task < last; task++)
+        {
+            queues[worker].push(task);
+        }
+    }
+
+    auto run_worker = [&](int worker)
+    {
+        int task;
+        while (true)
+        {
+            if (queues[worker].pop(task))
+            {
+                func(task, worker);
+                continue;
+            }
+
+            bool stole = false;
+            for (int offset = 1; offset < worker_count && !stole; offset++)
+            {
+                stole = queues[(worker + offset) % worker_count].steal(task);
+            }
+
+            if (!stole)
+            {
+                return;
+            }
+
+            func(task, worker);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(worker_count - 1);
+    for (int worker = 1; worker < worker_count; worker++)
+    {
+        threads.emplace_back(run_worker, worker);
+    }
+
+    run_worker(0);
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+template <typename Func>
+void parallel_for_chunks(size_t count, size_t chunk_size, int thread_count, const Func& func)
+{
+    // Runs func(begin, end) over [0, count) cut into chunks of chunk_size items, so streaming
+    // kernels pay the task overhead once per chunk rather than once per item.
+
+    int chunk_count = int((count + chunk_size - 1) / chunk_size);
+    parallel_for(chunk_count, thread_count, [&](int chunk, int worker)
+    {
+        size_t begin = size_t(chunk) * chunk_size;
+        func(begin, std::min(count, begin + chunk_size));
+    });
+}
+
+#endif
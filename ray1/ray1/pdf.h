@@ -3,67 +3,75 @@
 
 #include "onb.h"
 
+#include <variant>
 
-class pdf
-{
-public:
-    virtual ~pdf() {}
-
-    virtual double value(const vec3& direction) const = 0;
-    virtual vec3 generate() const = 0;
-};
+// PDFs are small value types that live on the stack of the shading loop. Materials hand back
+// one of the concrete directional PDFs through a material_pdf variant, and the light/material
+// mixture refers to both by reference, so sampling a bounce never touches the heap.
 
-class sphere_pdf : public pdf
+class sphere_pdf
 {
 public:
     sphere_pdf() {}
 
-    double value(const vec3& direction) const override
+    double value(const vec3& direction) const
     {
         return 1 / (4 * pi);
     }
 
-    vec3 generate() const override
+    vec3 generate(sampler& s) const
     {
-        return random_unit_vector();
+        return random_unit_vector(s);
     }
 };
 
-class cosine_pdf : public pdf
+class cosine_pdf
 {
 public:
     cosine_pdf(const vec3& w) : uvw(w) {}
 
-    double value(const vec3& direction) const override
+    double value(const vec3& direction) const
     {
         double cosine_theta = dot(unit_vector(direction), uvw.w());
         return std::fmax(0, cosine_theta / pi);
     }
 
-    vec3 generate() const override
+    vec3 generate(sampler& s) const
     {
-        return uvw.transform(random_cosine_direction());
+        return uvw.transform(random_cosine_direction(s));
     }
 
 private:
     onb uvw;
 };
 
-class hittable_pdf : public pdf
+using material_pdf = std::variant<sphere_pdf, cosine_pdf>;
+
+inline double pdf_value(const material_pdf& p, const vec3& direction)
+{
+    return std::visit([&](const auto& alternative) { return alternative.value(direction); }, p);
+}
+
+inline vec3 pdf_generate(const material_pdf& p, sampler& s)
+{
+    return std::visit([&](const auto& alternative) { return alternative.generate(s); }, p);
+}
+
+class hittable_pdf
 {
 public:
     hittable_pdf(const hittable& objects, const point3& origin)
         : objects(objects), origin(origin)
     {}
 
-    double value(const vec3& direction) const override
+    double value(const vec3& direction) const
     {
         return objects.pdf_value(origin, direction);
     }
 
-    vec3 generate() const override
+    vec3 generate(sampler& s) const
     {
-        return objects.random(origin);
+        return objects.random(origin, s);
     }
 
 private:
@@ -71,34 +79,36 @@ private:
     point3 origin;
 };
 
-class mixture_pdf : public pdf
+class mixture_pdf
 {
 public:
-    mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1)
-    {
-        p[0] = p0;
-        p[1] = p1;
-    }
+    // An even mix of sampling toward the lights and sampling the material's own PDF. Both
+    // are borrowed, so the mixture must not outlive them.
+
+    mixture_pdf(const hittable_pdf& light_pdf, const material_pdf& surface_pdf)
+        : light_pdf(light_pdf), surface_pdf(surface_pdf)
+    {}
 
-    double value(const vec3& direction) const override
+    double value(const vec3& direction) const
     {
-        return (0.5 * p[0]->value(direction) + 0.5 * p[1]->value(direction));
+        return (0.5 * light_pdf.value(direction) + 0.5 * pdf_value(surface_pdf, direction));
     }
 
-    vec3 generate() const override
+    vec3 generate(sampler& s) const
     {
-        if (random_double() < 0.5)
+        if (random_double(s) < 0.5)
         {
-            return p[0]->generate();
+            return light_pdf.generate(s);
         }
         else
         {
-            return p[1]->generate();
+            return pdf_generate(surface_pdf, s);
         }
     }
 
 private:
-    shared_ptr<pdf> p[2];
+    const hittable_pdf& light_pdf;
+    const material_pdf& surface_pdf;
 };
 
 #endif
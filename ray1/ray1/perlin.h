@@ -57,6 +57,17 @@ public:
         return std::fabs(accum);
     }
 
+    void hash_content(uint64_t& hash) const
+    {
+        for (int i = 0; i < point_count; i++)
+        {
+            hash_values(hash, { randvec[i].x(), randvec[i].y(), randvec[i].z() });
+        }
+        hash = hash_bytes(hash, perm_x, sizeof(perm_x));
+        hash = hash_bytes(hash, perm_y, sizeof(perm_y));
+        hash = hash_bytes(hash, perm_z, sizeof(perm_z));
+    }
+
 private:
     static const int point_count = 256;
     vec3 randvec[point_count];
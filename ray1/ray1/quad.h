@@ -3,6 +3,8 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "material.h"
+#include "oriented_box.h"
 
 class quad : public hittable
 {
@@ -32,39 +34,96 @@ public:
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override
     {
-        double denom = dot(normal, r.direction());
-
-        // No hit if the ray is parallel to the plane.
-        if (std::fabs(denom) < 1e-8)
+        double t;
+        point3 intersection;
+        if (!plane_hit(r, ray_t, rec, t, intersection))
         {
             return false;
         }
 
-        // Return false if the hit point parameter t is outside the ray interval.
-        double t = (D - dot(normal, r.origin())) / denom;
-        if (!ray_t.contains(t))
+        // Ray hits the 2D shape; set the rest of the hit record and return true.
+
+        set_hit_record(r, t, intersection, rec);
+        return true;
+    }
+
+    void hit_batch(const ray* rays, uint32_t* indices, size_t count, interval* intervals,
+                   hit_record* recs, char* did_hit) const override
+    {
+        for (size_t i = 0; i < count; i++)
         {
-            return false;
+            uint32_t k = indices[i];
+            double t;
+            point3 intersection;
+            if (plane_hit(rays[k], intervals[k], recs[k], t, intersection))
+            {
+                set_hit_record(rays[k], t, intersection, recs[k]);
+                intervals[k].max = real(t);
+                did_hit[k] = 1;
+            }
         }
+    }
 
-        point3 intersection = r.at(t);
-        vec3 planar_hitpt_vector = intersection - Q;
-        double alpha = dot(w, cross(planar_hitpt_vector, v));
-        double beta = dot(w, cross(u, planar_hitpt_vector));
+    uint32_t hit_packet(ray_packet& packet, hit_record* recs) const override
+    {
+        // Intersects every lane with the plane and computes its plane coordinates in one
+        // branch-free loop, with the same arithmetic as plane_hit(). The shape test and the
+        // record then run only for the lanes that reach the plane within their interval.
+
+        double ts[ray_packet::width];
+        double alphas[ray_packet::width];
+        double betas[ray_packet::width];
+        uint32_t on_plane = 0;
 
-        if (!is_interior(alpha, beta, rec))
+        for (int lane = 0; lane < ray_packet::width; lane++)
         {
-            return false;
+            real dx = packet.direction[0][lane];
+            real dy = packet.direction[1][lane];
+            real dz = packet.direction[2][lane];
+            real ox = packet.origin[0][lane];
+            real oy = packet.origin[1][lane];
+            real oz = packet.origin[2][lane];
+
+            double denom = normal.x() * dx + normal.y() * dy + normal.z() * dz;
+            double t = (D - (normal.x() * ox + normal.y() * oy + normal.z() * oz)) / denom;
+
+            real t_lane = real(t);
+            real px = (ox + t_lane * dx) - Q.x();
+            real py = (oy + t_lane * dy) - Q.y();
+            real pz = (oz + t_lane * dz) - Q.z();
+
+            // alpha = dot(w, cross(p, v)), beta = dot(w, cross(u, p))
+            alphas[lane] = w.x() * (py * v.z() - pz * v.y()) + w.y() * (pz * v.x() - px * v.z()) + w.z() * (px * v.y() - py * v.x());
+            betas[lane] = w.x() * (u.y() * pz - u.z() * py) + w.y() * (u.z() * px - u.x() * pz) + w.z() * (u.x() * py - u.y() * px);
+            ts[lane] = t;
+
+            bool in_range = (packet.t_min[lane] <= t_lane && t_lane <= packet.t_max[lane]);
+            on_plane |= uint32_t(!(std::fabs(denom) < 1e-8) && in_range) << lane;
         }
 
-        // Ray hits the 2D shape; set the rest of the hit record and return true.
+        uint32_t hits = 0;
+        on_plane &= packet.active;
+        for (int lane = 0; lane < ray_packet::width; lane++)
+        {
+            if (ray_packet::lane_set(on_plane, lane) && is_interior(alphas[lane], betas[lane], recs[lane]))
+            {
+                ray r = packet.get_ray(lane);
+                set_hit_record(r, ts[lane], r.at(ts[lane]), recs[lane]);
+                packet.t_max[lane] = real(ts[lane]);
+                hits |= (1u << lane);
+            }
+        }
 
-        rec.t = t;
-        rec.p = intersection;
-        rec.mat = mat;
-        rec.set_face_normal(r, normal);
+        return hits;
+    }
 
-        return true;
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        // is_interior() only writes the UV coordinates into the scratch record.
+        hit_record scratch;
+        double t;
+        point3 intersection;
+        return plane_hit(r, ray_t, scratch, t, intersection);
     }
 
     virtual bool is_interior(double a, double b, hit_record& rec) const
@@ -83,26 +142,47 @@ public:
         return true;
     }
 
+    shared_ptr<quad> transformed(const affine_transform& to_world) const
+    {
+        // An affine map takes the parallelogram to another with the same plane coordinates,
+        // so UVs carry over. A mirroring map would flip the normal relative to a transform
+        // wrapper's, so callers should keep those wrapped.
+        return make_shared<quad>(to_world.apply_point(Q), to_world.apply_vector(u), to_world.apply_vector(v), mat);
+    }
+
     double pdf_value(const point3& origin, const vec3& direction) const override
     {
-        hit_record rec;
-        if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+        hit_record scratch;
+        double t;
+        point3 intersection;
+        if (!plane_hit(ray(origin, direction), interval(0, infinity), scratch, t, intersection))
         {
             return 0;
         }
 
-        double distance_squared = rec.t * rec.t * direction.length_squared();
-        double cosine = std::fabs(dot(direction, rec.normal) / direction.length());
+        double distance_squared = t * t * direction.length_squared();
+        double cosine = std::fabs(dot(direction, normal) / direction.length());
 
         return distance_squared / (cosine * area);
     }
 
-    vec3 random(const point3& origin) const override
+    vec3 random(const point3& origin, sampler& s) const override
     {
-        vec3 p = Q + (random_double() * u) + (random_double() * v);
+        double a = random_double(s);
+        double b = random_double(s);
+        vec3 p = Q + (a * u) + (b * v);
         return p - origin;
     }
 
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash_vector(hash, Q);
+        hash_vector(hash, u);
+        hash_vector(hash, v);
+        hash_material(hash, mat.get());
+    }
+
 private:
     point3 Q;
     vec3 u, v;
@@ -112,13 +192,52 @@ private:
     vec3 normal;
     double D;
     double area;
+
+    void set_hit_record(const ray& r, double t, const point3& intersection, hit_record& rec) const
+    {
+        rec.t = t;
+        rec.p = intersection;
+
+        // The hit point inherits the error of the plane equation evaluated at the ray origin,
+        // and a ray spawned here evaluates it again near the hit point.
+        rec.p_error = rounding_error_bound(7) * (std::fabs(D) + max_abs_component(r.origin()) + max_abs_component(intersection));
+        rec.mat = mat.get();
+        rec.set_face_normal(r, normal);
+    }
+
+    bool plane_hit(const ray& r, interval ray_t, hit_record& rec, double& t, point3& intersection) const
+    {
+        // Intersects the ray with the quad's plane and tests the hit against the shape,
+        // without touching the material or normal.
+
+        double denom = dot(normal, r.direction());
+
+        // No hit if the ray is parallel to the plane.
+        if (std::fabs(denom) < 1e-8)
+        {
+            return false;
+        }
+
+        // Return false if the hit point parameter t is outside the ray interval.
+        t = (D - dot(normal, r.origin())) / denom;
+        if (!ray_t.contains(t))
+        {
+            return false;
+        }
+
+        intersection = r.at(t);
+        vec3 planar_hitpt_vector = intersection - Q;
+        double alpha = dot(w, cross(planar_hitpt_vector, v));
+        double beta = dot(w, cross(u, planar_hitpt_vector));
+
+        return is_interior(alpha, beta, rec);
+    }
 };
 
-shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_ptr<material> mat)
+shared_ptr<hittable> box(const point3& a, const point3& b, shared_ptr<material> mat, bool analytic = false)
 {
-    // Returns the 3D box (six sides) that contains the two opposite vertices a & b.
-
-    shared_ptr<hittable_list> sides = make_shared<hittable_list>();
+    // Returns the 3D box (six sides) that contains the two opposite vertices a & b: one
+    // oriented_box if analytic is set, otherwise a list of six quads.
 
     // Construct the two opposite vertices with the minimum and maximum coordinates.
     point3 min = point3(std::fmin(a.x(), b.x()), std::fmin(a.y(), b.y()), std::fmin(a.z(), b.z()));
@@ -128,6 +247,13 @@ shared_ptr<hittable_list> box(const point3& a, const point3& b, shared_ptr<mater
     vec3 dy = vec3(0, max.y() - min.y(), 0);
     vec3 dz = vec3(0, 0, max.z() - min.z());
 
+    if (analytic)
+    {
+        return make_shared<oriented_box>(min, dx, dy, dz, mat);
+    }
+
+    shared_ptr<hittable_list> sides = make_shared<hittable_list>();
+
     sides->add(make_shared<quad>(point3(min.x(), min.y(), max.z()), dx, dy, mat)); // front
     sides->add(make_shared<quad>(point3(max.x(), min.y(), max.z()), -dz, dy, mat)); // right
     sides->add(make_shared<quad>(point3(max.x(), min.y(), min.z()), -dx, dy, mat)); // back
@@ -8,7 +8,14 @@ class ray
 public:
 	ray() {}
 
-	ray(const point3& origin, const vec3& direction, double time) : orig(origin), dir(direction), tm(time) {}
+	ray(const point3& origin, const vec3& direction, double time) : orig(origin), dir(direction), tm(time)
+	{
+		// Precompute what every slab test needs, once per ray rather than once per box.
+		inv_dir = vec3(1.0 / dir.x(), 1.0 / dir.y(), 1.0 / dir.z());
+		sign[0] = (inv_dir.x() < 0);
+		sign[1] = (inv_dir.y() < 0);
+		sign[2] = (inv_dir.z() < 0);
+	}
 
 	ray(const point3& origin, const vec3& direction) : ray(origin, direction, 0) {}
 
@@ -17,15 +24,30 @@ public:
 
 	double time() const { return tm; }
 
+	const vec3& inv_direction() const { return inv_dir; }
+
+	// 1 if the direction is negative along the axis, else 0: the index of the near slab plane.
+	int dir_sign(int axis) const { return sign[axis]; }
+
 	point3 at(double t) const
 	{
 		return orig + t * dir;
 	}
 
+	ray with_origin(const point3& origin) const
+	{
+		// The same ray moved to a new origin, reusing the cached inverse direction.
+		ray moved = *this;
+		moved.orig = origin;
+		return moved;
+	}
+
 private:
 	point3 orig;
 	vec3 dir;
 	double tm;
+	vec3 inv_dir;
+	int sign[3];
 };
 
 #endif
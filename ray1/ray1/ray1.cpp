@@ -9,6 +9,7 @@
 #include "quad.h"
 #include "sphere.h"
 #include "texture.h"
+#include "transform.h"
 
 //void bouncing_spheres()
 //{
@@ -334,7 +335,7 @@
 //            double y1 = random_double(1, 101);
 //            double z1 = z0 + w;
 //
-//            boxes1.add(box(point3(x0, y0, z0), point3(x1, y1, z1), ground));
+//            boxes1.add(box(point3(x0, y0, z0), point3(x1, y1, z1), ground, true));
 //        }
 //    }
 //
@@ -427,7 +428,7 @@ int main()
     world.add(make_shared<quad>(point3(213, 554, 227), vec3(130, 0, 0), vec3(0, 0, 105), light));
 
     // Box
-    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white);
+    shared_ptr<hittable> box1 = box(point3(0, 0, 0), point3(165, 330, 165), white, true);
     box1 = make_shared<rotate_y>(box1, 15);
     box1 = make_shared<translate>(box1, vec3(265, 0, 295));
     world.add(box1);
@@ -437,9 +438,10 @@ int main()
     world.add(make_shared<sphere>(point3(190, 90, 190), 90, glass));
 
     // Light Sources
+    // The quad carries the light material so next event estimation can read its emission.
     shared_ptr<material> empty_material = shared_ptr<material>();
     hittable_list lights;
-    lights.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), empty_material));
+    lights.add(make_shared<quad>(point3(343, 554, 332), vec3(-130, 0, 0), vec3(0, 0, -105), light));
     lights.add(make_shared<sphere>(point3(190, 90, 190), 90, empty_material));
 
     camera cam;
@@ -447,8 +449,9 @@ int main()
     cam.aspect_ratio = 1.0;
     cam.image_width = 600;
     cam.samples_per_pixel = 1000;
-    //cam.max_depth = 50;
-    cam.max_depth = 5;
+    cam.max_depth = 50;
+    cam.russian_roulette = true;
+    cam.rr_min_depth = 3;
     cam.background = color(0, 0, 0);
 
     cam.vfov = 40;
@@ -458,6 +461,20 @@ int main()
 
     cam.defocus_angle = 0;
 
+    cam.next_event_estimation = false;
+    cam.ray_packets = false;        // Camera rays of neighbouring pixels traced as packets; same image
+    cam.wavefront = false;          // Breadth-first stage-by-stage integrator; same image
+    cam.adaptive_sampling = false;  // samples_per_pixel becomes the per-pixel cap
+    cam.progressive = false;        // With checkpoint_file set, an interrupted render resumes
+    cam.checkpoint_file = "cornell.ckpt";
+    cam.time_budget = 0;            // Seconds; when set, renders passes until the budget runs out
+    cam.thread_count = 0;
+    cam.output_format = image_format::ppm_ascii;  // ppm_binary, pfm or exr need output_file or a redirect
+    cam.output_file = "";
+
+    // Collapse the box's rotate_y/translate chain and bake it into the box itself.
+    world = fold_transforms(world);
+
     cam.render(world, lights);
 
     return 0;
@@ -0,0 +1,148 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include <cstdint>
+
+// Lanes per ray packet: 4, 8 or 16. The camera fills a packet from a 2x2, 4x2 or 4x4 block of
+// pixels.
+#ifndef RTW_PACKET_WIDTH
+#define RTW_PACKET_WIDTH 16
+#endif
+
+namespace packet_simd
+{
+    // The widest SIMD register of `real` the build has, for running packet tests a group of
+    // lanes at a time. load_float widens stored float bounds to `real` lanes. max and min
+    // keep the `a > b ? a : b` and `a < b ? a : b` semantics of the scalar slab test, NaNs
+    // included, so packet and single-ray traversal agree exactly.
+
+#if defined(RTW_SSE) && defined(RTW_USE_FLOAT)
+    using lanes_t = __m128;
+    constexpr int lanes = 4;
+    inline lanes_t load(const float* p) { return _mm_load_ps(p); }
+    inline lanes_t load_float(const float* p) { return _mm_load_ps(p); }
+    inline void store(float* p, lanes_t a) { _mm_store_ps(p, a); }
+    inline lanes_t broadcast(float x) { return _mm_set1_ps(x); }
+    inline lanes_t sub(lanes_t a, lanes_t b) { return _mm_sub_ps(a, b); }
+    inline lanes_t mul(lanes_t a, lanes_t b) { return _mm_mul_ps(a, b); }
+    inline lanes_t max(lanes_t a, lanes_t b) { return _mm_max_ps(a, b); }
+    inline lanes_t min(lanes_t a, lanes_t b) { return _mm_min_ps(a, b); }
+    inline lanes_t less(lanes_t a, lanes_t b) { return _mm_cmplt_ps(a, b); }
+    inline lanes_t select(lanes_t mask, lanes_t a, lanes_t b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    inline uint32_t bits(lanes_t mask) { return uint32_t(_mm_movemask_ps(mask)); }
+#elif defined(RTW_AVX) && !defined(RTW_USE_FLOAT)
+    using lanes_t = __m256d;
+    constexpr int lanes = 4;
+    inline lanes_t load(const double* p) { return _mm256_load_pd(p); }
+    inline lanes_t load_float(const float* p) { return _mm256_cvtps_pd(_mm_load_ps(p)); }
+    inline void store(double* p, lanes_t a) { _mm256_store_pd(p, a); }
+    inline lanes_t broadcast(double x) { return _mm256_set1_pd(x); }
+    inline lanes_t sub(lanes_t a, lanes_t b) { return _mm256_sub_pd(a, b); }
+    inline lanes_t mul(lanes_t a, lanes_t b) { return _mm256_mul_pd(a, b); }
+    inline lanes_t max(lanes_t a, lanes_t b) { return _mm256_max_pd(a, b); }
+    inline lanes_t min(lanes_t a, lanes_t b) { return _mm256_min_pd(a, b); }
+    inline lanes_t less(lanes_t a, lanes_t b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    inline lanes_t select(lanes_t mask, lanes_t a, lanes_t b) { return _mm256_blendv_pd(b, a, mask); }
+    inline uint32_t bits(lanes_t mask) { return uint32_t(_mm256_movemask_pd(mask)); }
+#elif defined(RTW_SSE) && !defined(RTW_USE_FLOAT)
+    using lanes_t = __m128d;
+    constexpr int lanes = 2;
+    inline lanes_t load(const double* p) { return _mm_load_pd(p); }
+    inline lanes_t load_float(const float* p) { return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)))); }
+    inline void store(double* p, lanes_t a) { _mm_store_pd(p, a); }
+    inline lanes_t broadcast(double x) { return _mm_set1_pd(x); }
+    inline lanes_t sub(lanes_t a, lanes_t b) { return _mm_sub_pd(a, b); }
+    inline lanes_t mul(lanes_t a, lanes_t b) { return _mm_mul_pd(a, b); }
+    inline lanes_t max(lanes_t a, lanes_t b) { return _mm_max_pd(a, b); }
+    inline lanes_t min(lanes_t a, lanes_t b) { return _mm_min_pd(a, b); }
+    inline lanes_t less(lanes_t a, lanes_t b) { return _mm_cmplt_pd(a, b); }
+    inline lanes_t select(lanes_t mask, lanes_t a, lanes_t b) { return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)); }
+    inline uint32_t bits(lanes_t mask) { return uint32_t(_mm_movemask_pd(mask)); }
+#else
+    using lanes_t = real;
+    constexpr int lanes = 1;
+    inline lanes_t load(const real* p) { return *p; }
+    inline lanes_t load_float(const float* p) { return real(*p); }
+    inline void store(real* p, lanes_t a) { *p = a; }
+    inline lanes_t broadcast(real x) { return x; }
+    inline lanes_t sub(lanes_t a, lanes_t b) { return a - b; }
+    inline lanes_t mul(lanes_t a, lanes_t b) { return a * b; }
+    inline lanes_t max(lanes_t a, lanes_t b) { return (a > b ? a : b); }
+    inline lanes_t min(lanes_t a, lanes_t b) { return (a < b ? a : b); }
+    inline bool less(lanes_t a, lanes_t b) { return a < b; }
+    inline lanes_t select(bool mask, lanes_t a, lanes_t b) { return (mask ? a : b); }
+    inline uint32_t bits(bool mask) { return uint32_t(mask); }
+#endif
+}
+
+struct ray_packet
+{
+    // A bundle of rays stored structure-of-arrays, so a box or primitive test runs over every
+    // lane in one loop the compiler can vectorize. Each lane carries its own [t_min, t_max]
+    // interval, and intersection narrows t_max to the closest hit so far, as closest_so_far
+    // does for a single ray. Bit k of `active` is set while lane k takes part.
+
+    static constexpr int width = RTW_PACKET_WIDTH;
+    static_assert(width == 4 || width == 8 || width == 16, "ray packets are 4, 8 or 16 lanes wide");
+
+    alignas(64) real origin[3][width];
+    alignas(64) real direction[3][width];
+    alignas(64) real inv_direction[3][width];
+    alignas(64) real time[width];
+    alignas(64) real t_min[width];
+    alignas(64) real t_max[width];
+    uint32_t active = 0;
+
+    void set(int lane, const ray& r, interval ray_t)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            origin[axis][lane] = r.origin()[axis];
+            direction[axis][lane] = r.direction()[axis];
+            inv_direction[axis][lane] = r.inv_direction()[axis];
+        }
+        time[lane] = real(r.time());
+        t_min[lane] = ray_t.min;
+        t_max[lane] = ray_t.max;
+        active |= (1u << lane);
+    }
+
+    void clear(int lane)
+    {
+        // Gives an inactive lane defined contents, so whole-packet loops never read garbage:
+        // a ray of zero length at the origin with an empty interval.
+        for (int axis = 0; axis < 3; axis++)
+        {
+            origin[axis][lane] = 0;
+            direction[axis][lane] = 0;
+            inv_direction[axis][lane] = 0;
+        }
+        time[lane] = 0;
+        t_min[lane] = 0;
+        t_max[lane] = 0;
+        active &= ~(1u << lane);
+    }
+
+    ray get_ray(int lane) const
+    {
+        return ray(point3(origin[0][lane], origin[1][lane], origin[2][lane]),
+                   vec3(direction[0][lane], direction[1][lane], direction[2][lane]), time[lane]);
+    }
+
+    point3 get_origin(int lane) const
+    {
+        return point3(origin[0][lane], origin[1][lane], origin[2][lane]);
+    }
+
+    interval get_interval(int lane) const
+    {
+        return interval(t_min[lane], t_max[lane]);
+    }
+
+    static bool lane_set(uint32_t mask, int lane)
+    {
+        return ((mask >> lane) & 1) != 0;
+    }
+};
+
+#endif
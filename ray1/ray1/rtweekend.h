@@ -2,12 +2,16 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <initializer_list>
 #include <iostream>
 #include <iomanip>
 #include <limits>
 #include <memory>
 #include <random>
+#include <typeinfo>
 
 
 // C++ Std Usings
@@ -15,6 +19,17 @@
 using std::make_shared;
 using std::shared_ptr;
 
+// Scalar Type
+//
+// The scalar that vectors, colors, intervals and bounding boxes are stored in. Define
+// RTW_USE_FLOAT to build the renderer in single precision, halving the memory those take.
+
+#ifdef RTW_USE_FLOAT
+using real = float;
+#else
+using real = double;
+#endif
+
 // Constants
 
 const double infinity = std::numeric_limits<double>::infinity();
@@ -27,10 +42,20 @@ inline double degrees_to_radians(double degrees)
     return degrees * pi / 180.0;
 }
 
+inline constexpr real rounding_error_bound(int n)
+{
+    // Bound on the relative error of n chained floating-point operations in real, the gamma(n)
+    // of Higham's error analysis.
+    constexpr real unit_roundoff = std::numeric_limits<real>::epsilon() / 2;
+    return (n * unit_roundoff) / (1 - n * unit_roundoff);
+}
+
 inline double random_double()
 {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
+    // Used while building scenes. Render paths draw from their own sampler stream instead,
+    // but keep one generator per thread so stray calls from workers never race.
+    thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    thread_local std::mt19937 generator;
     return distribution(generator);
 }
 
@@ -46,8 +71,43 @@ inline int random_int(int min, int max)
     return int(random_double(min, max + 1));
 }
 
+// Content Hashing
+//
+// 64-bit FNV-1a. Checkpoints fingerprint the scene with it: hittables, materials and textures
+// feed their type and parameters in through hash_content(), so resuming against a different
+// scene is caught.
+
+const uint64_t hash_seed = 0xcbf29ce484222325ull;
+
+inline uint64_t hash_bytes(uint64_t hash, const void* bytes, size_t size)
+{
+    const unsigned char* data = static_cast<const unsigned char*>(bytes);
+    for (size_t k = 0; k < size; k++)
+    {
+        hash = (hash ^ data[k]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+inline void hash_values(uint64_t& hash, std::initializer_list<double> values)
+{
+    for (double value : values)
+    {
+        hash = hash_bytes(hash, &value, sizeof(value));
+    }
+}
+
+inline void hash_type(uint64_t& hash, const std::type_info& type)
+{
+    // Keeps objects of different types with the same parameters apart.
+    const char* name = type.name();
+    hash = hash_bytes(hash, name, std::strlen(name));
+}
+
 // Common Headers
 
+#include "sampler.h"
+
 #include "color.h"
 #include "interval.h"
 #include "ray.h"
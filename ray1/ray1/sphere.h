@@ -2,6 +2,7 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "material.h"
 #include "onb.h"
 
 class sphere : public hittable
@@ -18,8 +19,21 @@ public:
     // Moving Sphere
     sphere(const point3& center1, const point3& center2, double radius,
            shared_ptr<material> mat)
-        : center(center1, center2 - center1), radius(std::fmax(0, radius)), mat(mat)
+        : radius(std::fmax(0, radius)), mat(mat)
     {
+        set_motion(center1, center2);
+    }
+
+    // Moves the sphere for a new frame of an animation. A BVH containing it must then be
+    // refit or rebuilt.
+    void set_center(const point3& static_center)
+    {
+        set_motion(static_center, static_center);
+    }
+
+    void set_motion(const point3& center1, const point3& center2)
+    {
+        center = ray(center1, center2 - center1);
         vec3 rvec = vec3(radius, radius, radius);
         aabb box1(center.at(0) - rvec, center.at(0) + rvec);
         aabb box2(center.at(1) - rvec, center.at(1) + rvec);
@@ -29,48 +43,113 @@ public:
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override
     {
         point3 current_center = center.at(r.time());
-        vec3 oc = current_center - r.origin();
-        double a = r.direction().length_squared();
-        double h = dot(r.direction(), oc);
-        double c = oc.length_squared() - radius * radius;
-
-        double discriminant = h * h - a * c;
-        if (discriminant < 0)
+        double root;
+        if (!nearest_root(r, ray_t, current_center, root))
         {
             return false;
         }
 
-        double sqrtd = std::sqrt(discriminant);
+        set_hit_record(r, root, current_center, rec);
+        return true;
+    }
 
-        // Find the nearest root that lies in the acceptable range.
-        double root = (h - sqrtd) / a;
-        if (!ray_t.surrounds(root))
+    void hit_batch(const ray* rays, uint32_t* indices, size_t count, interval* intervals,
+                   hit_record* recs, char* did_hit) const override
+    {
+        for (size_t i = 0; i < count; i++)
         {
-            root = (h + sqrtd) / a;
-            if (!ray_t.surrounds(root))
+            uint32_t k = indices[i];
+            const ray& r = rays[k];
+            point3 current_center = center.at(r.time());
+            double root;
+            if (nearest_root(r, intervals[k], current_center, root))
             {
-                return false;
+                set_hit_record(r, root, current_center, recs[k]);
+                intervals[k].max = real(root);
+                did_hit[k] = 1;
             }
         }
+    }
 
-        rec.t = root;
-        rec.p = r.at(rec.t);
-        vec3 outward_normal = (rec.p - current_center) / radius;
-        rec.set_face_normal(r, outward_normal);
-        get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat = mat;
+    uint32_t hit_packet(ray_packet& packet, hit_record* recs) const override
+    {
+        // Solves every lane's quadratic in one branch-free loop, with the same arithmetic as
+        // nearest_root(), then fills in records only for the lanes that hit.
 
-        return true;
+        double roots[ray_packet::width];
+        uint32_t found = 0;
+
+        const point3& center0 = center.origin();
+        const vec3& motion = center.direction();
+
+        for (int lane = 0; lane < ray_packet::width; lane++)
+        {
+            real time = packet.time[lane];
+            real dx = packet.direction[0][lane];
+            real dy = packet.direction[1][lane];
+            real dz = packet.direction[2][lane];
+            real ocx = (center0.x() + time * motion.x()) - packet.origin[0][lane];
+            real ocy = (center0.y() + time * motion.y()) - packet.origin[1][lane];
+            real ocz = (center0.z() + time * motion.z()) - packet.origin[2][lane];
+
+            double a = dx * dx + dy * dy + dz * dz;
+            double h = dx * ocx + dy * ocy + dz * ocz;
+            double c = (ocx * ocx + ocy * ocy + ocz * ocz) - radius * radius;
+
+            real scale = real(h / a);
+            real px = ocx - scale * dx;
+            real py = ocy - scale * dy;
+            real pz = ocz - scale * dz;
+            double discriminant = a * (radius * radius - (px * px + py * py + pz * pz));
+
+            double q = h + std::copysign(std::sqrt(discriminant < 0 ? 0 : discriminant), h);
+            double near_root = c / q;
+            double far_root = q / a;
+            double first = (near_root > far_root ? far_root : near_root);
+            double second = (near_root > far_root ? near_root : far_root);
+
+            real t_min = packet.t_min[lane];
+            real t_max = packet.t_max[lane];
+            bool first_in_range = (t_min < real(first) && real(first) < t_max);
+            bool second_in_range = (t_min < real(second) && real(second) < t_max);
+
+            roots[lane] = (first_in_range ? first : second);
+            found |= uint32_t(discriminant >= 0 && (first_in_range || second_in_range)) << lane;
+        }
+
+        found &= packet.active;
+        for (int lane = 0; lane < ray_packet::width; lane++)
+        {
+            if (ray_packet::lane_set(found, lane))
+            {
+                ray r = packet.get_ray(lane);
+                set_hit_record(r, roots[lane], center.at(r.time()), recs[lane]);
+                packet.t_max[lane] = real(roots[lane]);
+            }
+        }
+
+        return found;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        double root;
+        return nearest_root(r, ray_t, center.at(r.time()), root);
     }
 
     aabb bounding_box() const override { return bbox; }
 
+    aabb bounding_box_at(double time) const override
+    {
+        vec3 rvec = vec3(radius, radius, radius);
+        return aabb(center.at(time) - rvec, center.at(time) + rvec);
+    }
+
     double pdf_value(const point3& origin, const vec3& direction) const override
     {
         // This method only works for stationary spheres.
 
-        hit_record rec;
-        if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+        if (!this->occluded(ray(origin, direction), interval(0, infinity)))
         {
             return 0;
         }
@@ -82,12 +161,21 @@ public:
         return  1 / solid_angle;
     }
 
-    vec3 random(const point3& origin) const override
+    vec3 random(const point3& origin, sampler& s) const override
     {
         vec3 direction = center.at(0) - origin;
         double distance_squared = direction.length_squared();
         onb uvw(direction);
-        return uvw.transform(random_to_sphere(radius, distance_squared));
+        return uvw.transform(random_to_sphere(s, radius, distance_squared));
+    }
+
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash_vector(hash, center.origin());
+        hash_vector(hash, center.direction());
+        hash_values(hash, { radius });
+        hash_material(hash, mat.get());
     }
 
 private:
@@ -96,6 +184,63 @@ private:
     shared_ptr<material> mat;
     aabb bbox;
 
+    bool nearest_root(const ray& r, interval ray_t, const point3& current_center, double& root) const
+    {
+        // The roots of a t^2 - 2h t + c = 0, arranged after Haines et al., "Precision
+        // Improvements for Ray/Sphere Intersection" (Ray Tracing Gems, chapter 7). The
+        // discriminant comes from the center's offset from the ray line rather than from
+        // h^2 - a c, which cancels badly far from the sphere, and the two roots are formed
+        // without subtracting nearly equal values. This keeps large spheres accurate in float.
+
+        vec3 oc = current_center - r.origin();
+        double a = r.direction().length_squared();
+        double h = dot(r.direction(), oc);
+        double c = oc.length_squared() - radius * radius;
+
+        vec3 perpendicular = oc - (h / a) * r.direction();
+        double discriminant = a * (radius * radius - perpendicular.length_squared());
+        if (discriminant < 0)
+        {
+            return false;
+        }
+
+        double q = h + std::copysign(std::sqrt(discriminant), h);
+        double near_root = c / q;
+        double far_root = q / a;
+        if (near_root > far_root)
+        {
+            std::swap(near_root, far_root);
+        }
+
+        // Find the nearest root that lies in the acceptable range.
+        root = near_root;
+        if (!ray_t.surrounds(root))
+        {
+            root = far_root;
+            if (!ray_t.surrounds(root))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void set_hit_record(const ray& r, double root, const point3& current_center, hit_record& rec) const
+    {
+        rec.t = root;
+        vec3 outward_normal = unit_vector(r.at(rec.t) - current_center);
+
+        // Project the hit point onto the surface. Its error then depends only on the size and
+        // placement of the sphere, which is also what bounds the error of the next intersection
+        // test from just outside it.
+        rec.p = current_center + radius * outward_normal;
+        rec.p_error = rounding_error_bound(8) * (max_abs_component(current_center) + radius);
+        rec.set_face_normal(r, outward_normal);
+        get_sphere_uv(outward_normal, rec.u, rec.v);
+        rec.mat = mat.get();
+    }
+
     static void get_sphere_uv(const point3& p, double& u, double& v)
     {
         // p: a given point on the sphere of radius one, centered at the origin.
@@ -112,10 +257,10 @@ private:
         v = theta / pi;
     }
 
-    static vec3 random_to_sphere(double radius, double distance_squared)
+    static vec3 random_to_sphere(sampler& s, double radius, double distance_squared)
     {
-        double r1 = random_double();
-        double r2 = random_double();
+        double r1 = random_double(s);
+        double r2 = random_double(s);
         double z = 1 + r2 * (std::sqrt(1 - radius * radius / distance_squared) - 1);
 
         double phi = 2 * pi * r1;
@@ -10,6 +10,12 @@ public:
     virtual ~texture() = default;
 
     virtual color value(double u, double v, const point3& p) const = 0;
+
+    virtual void hash_content(uint64_t& hash) const
+    {
+        // Feeds the texture's parameters into a scene fingerprint; see hittable::hash_content().
+        hash_type(hash, typeid(*this));
+    }
 };
 
 class solid_color : public texture
@@ -24,6 +30,12 @@ public:
         return albedo;
     }
 
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash_values(hash, { albedo.x(), albedo.y(), albedo.z() });
+    }
+
 private:
     color albedo;
 };
@@ -50,6 +62,14 @@ public:
         return (isEven ? even->value(u, v, p) : odd->value(u, v, p));
     }
 
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash_values(hash, { inv_scale });
+        even->hash_content(hash);
+        odd->hash_content(hash);
+    }
+
 private:
     double inv_scale;
     shared_ptr<texture> even;
@@ -81,6 +101,17 @@ public:
         return color(color_scale * pixel[0], color_scale * pixel[1], color_scale * pixel[2]);
     }
 
+    void hash_content(uint64_t& hash) const override
+    {
+        // The pixels themselves, so replacing the image file is noticed too.
+        hash_type(hash, typeid(*this));
+        hash_values(hash, { double(image.width()), double(image.height()) });
+        for (int j = 0; j < image.height(); j++)
+        {
+            hash = hash_bytes(hash, image.pixel_data(0, j), size_t(image.width()) * 3);
+        }
+    }
+
 private:
     rtw_image image;
 };
@@ -95,6 +126,13 @@ public:
         return color(.5, .5, .5) * (1 + std::sin(scale * p.z() + 10 * noise.turb(p, 7)));
     }
 
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash_values(hash, { scale });
+        noise.hash_content(hash);
+    }
+
 private:
     perlin noise;
     double scale;
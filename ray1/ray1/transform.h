@@ -0,0 +1,255 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "affine.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "oriented_box.h"
+#include "quad.h"
+
+#include <typeinfo>
+
+class transform : public hittable
+{
+public:
+    // An object seen through an arbitrary affine object-to-world transform. One transform
+    // costs a single matrix multiply each way per ray, where a chain of translate and
+    // rotate_y wrappers pays a virtual call and a ray copy per link; fold_transforms()
+    // below replaces such chains with one of these.
+
+    transform(shared_ptr<hittable> object, const affine_transform& object_to_world)
+        : object(object)
+    {
+        set_transform(object_to_world);
+    }
+
+    void set_transform(const affine_transform& object_to_world)
+    {
+        // A BVH containing the transform must then be refit or rebuilt.
+        to_world = object_to_world;
+        to_object = object_to_world.inverse();
+        bbox = to_world.apply_box(object->bounding_box());
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        // The object-space direction is not renormalized, so t means the same in both
+        // spaces and the interval carries over unchanged.
+
+        if (!object->hit(to_object_space(r), ray_t, rec))
+        {
+            return false;
+        }
+
+        to_world_space(rec);
+        return true;
+    }
+
+    uint32_t hit_packet(ray_packet& packet, hit_record* recs) const override
+    {
+        // Map every lane into object space, with the same arithmetic as to_object_space().
+        ray_packet local = packet;
+        for (int lane = 0; lane < ray_packet::width; lane++)
+        {
+            point3 origin = to_object.apply_point(packet.get_origin(lane));
+            vec3 direction = to_object.apply_vector(vec3(packet.direction[0][lane], packet.direction[1][lane],
+                                                         packet.direction[2][lane]));
+            for (int axis = 0; axis < 3; axis++)
+            {
+                local.origin[axis][lane] = real(origin[axis]);
+                local.direction[axis][lane] = real(direction[axis]);
+                local.inv_direction[axis][lane] = real(1.0 / local.direction[axis][lane]);
+            }
+        }
+
+        uint32_t hits = object->hit_packet(local, recs);
+        for (int lane = 0; lane < ray_packet::width; lane++)
+        {
+            if (ray_packet::lane_set(hits, lane))
+            {
+                packet.t_max[lane] = local.t_max[lane];
+                to_world_space(recs[lane]);
+            }
+        }
+
+        return hits;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        return object->occluded(to_object_space(r), ray_t);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    aabb bounding_box_at(double time) const override { return to_world.apply_box(object->bounding_box_at(time)); }
+
+    aabb refit_bounds() override
+    {
+        bbox = to_world.apply_box(object->refit_bounds());
+        return bbox;
+    }
+
+    const shared_ptr<hittable>& wrapped() const { return object; }
+
+    const affine_transform& object_to_world() const { return to_world; }
+
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash = hash_bytes(hash, to_world.m, sizeof(to_world.m));
+        object->hash_content(hash);
+    }
+
+private:
+    shared_ptr<hittable> object;
+    affine_transform to_world;
+    affine_transform to_object;
+    aabb bbox;
+
+    ray to_object_space(const ray& r) const
+    {
+        return ray(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()), r.time());
+    }
+
+    void to_world_space(hit_record& rec) const
+    {
+        // Each world component sums three products and the translation, scaling the
+        // object-space error by at most the linear part's norm.
+
+        double scale = to_world.linear_norm();
+        rec.p_error = scale * rec.p_error
+                    + rounding_error_bound(4) * (scale * max_abs_component(rec.p) + max_abs_component(to_world.translation_part()));
+        rec.p = to_world.apply_point(rec.p);
+
+        // Normals go through the inverse transpose; a linear map keeps which side of the
+        // surface the ray came from, so front_face still holds.
+        rec.normal = unit_vector(to_object.apply_transposed(rec.normal));
+    }
+};
+
+// Transform folding: a scene pass that collapses every chain of translate, rotate_y and
+// transform wrappers into at most one transform, and bakes the transform into the geometry
+// itself where that is exact and free at render time. The input is never modified; shared
+// objects that need no change are shared by the result too.
+
+inline void peel_transforms(shared_ptr<hittable>& object, affine_transform& to_world)
+{
+    // Strips the wrappers off `object`, composing their transforms into to_world. Only exact
+    // transform types are peeled: subclasses such as instance change more than the geometry.
+
+    while (true)
+    {
+        const hittable& outer = *object;
+        if (typeid(outer) == typeid(translate))
+        {
+            const translate& wrapper = static_cast<const translate&>(outer);
+            to_world = to_world * wrapper.object_to_world();
+            object = wrapper.wrapped();
+        }
+        else if (typeid(outer) == typeid(rotate_y))
+        {
+            const rotate_y& wrapper = static_cast<const rotate_y&>(outer);
+            to_world = to_world * wrapper.object_to_world();
+            object = wrapper.wrapped();
+        }
+        else if (typeid(outer) == typeid(transform))
+        {
+            const transform& wrapper = static_cast<const transform&>(outer);
+            to_world = to_world * wrapper.object_to_world();
+            object = wrapper.wrapped();
+        }
+        else
+        {
+            return;
+        }
+    }
+}
+
+inline shared_ptr<hittable> fold_transforms(shared_ptr<hittable> object, affine_transform to_world);
+
+inline shared_ptr<hittable> bake_transform(shared_ptr<hittable> object, affine_transform to_world)
+{
+    // Returns the object with to_world applied to its geometry, or null if it cannot take
+    // it. Quads can, since an affine map keeps a parallelogram a parallelogram, and so can
+    // oriented boxes; a list can if all its elements can. Mirrored quads stay wrapped, which
+    // keeps the normal the transform wrapper would give.
+
+    peel_transforms(object, to_world);
+    if (to_world.is_identity())
+    {
+        return fold_transforms(object, to_world);
+    }
+
+    const hittable& inner = *object;
+    if (typeid(inner) == typeid(quad) && to_world.determinant() > 0)
+    {
+        return static_cast<const quad&>(inner).transformed(to_world);
+    }
+
+    if (typeid(inner) == typeid(oriented_box))
+    {
+        return static_cast<const oriented_box&>(inner).transformed(to_world);
+    }
+
+    if (typeid(inner) == typeid(hittable_list))
+    {
+        auto baked = make_shared<hittable_list>();
+        for (const shared_ptr<hittable>& element : static_cast<const hittable_list&>(inner).objects)
+        {
+            shared_ptr<hittable> baked_element = bake_transform(element, to_world);
+            if (!baked_element)
+            {
+                return nullptr;
+            }
+            baked->add(baked_element);
+        }
+        return baked;
+    }
+
+    return nullptr;
+}
+
+inline shared_ptr<hittable> fold_transforms(shared_ptr<hittable> object, affine_transform to_world)
+{
+    // The object seen through to_world, with every wrapper chain inside it folded.
+
+    peel_transforms(object, to_world);
+    if (!to_world.is_identity())
+    {
+        if (shared_ptr<hittable> baked = bake_transform(object, to_world))
+        {
+            return baked;
+        }
+        return make_shared<transform>(fold_transforms(object, affine_transform()), to_world);
+    }
+
+    if (typeid(*object) == typeid(hittable_list))
+    {
+        auto folded = make_shared<hittable_list>();
+        for (const shared_ptr<hittable>& element : static_cast<const hittable_list&>(*object).objects)
+        {
+            folded->add(fold_transforms(element, affine_transform()));
+        }
+        return folded;
+    }
+
+    return object;
+}
+
+inline shared_ptr<hittable> fold_transforms(shared_ptr<hittable> object)
+{
+    return fold_transforms(object, affine_transform());
+}
+
+inline hittable_list fold_transforms(const hittable_list& scene)
+{
+    hittable_list folded;
+    for (const shared_ptr<hittable>& object : scene.objects)
+    {
+        folded.add(fold_transforms(object));
+    }
+    return folded;
+}
+
+#endif
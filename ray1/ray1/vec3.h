@@ -1,136 +1,383 @@
 #ifndef VEC3_H
 #define VEC3_H
 
-class vec3
+// vec3 is templated on its scalar type. The renderer uses vec3_t<real>, which is double unless
+// the build defines RTW_USE_FLOAT (see rtweekend.h).
+//
+// Where SSE2 is available the float vector is stored as four 16-byte-aligned lanes, the fourth
+// always zero, so its arithmetic, dot, cross and unit_vector each compile to a handful of packed
+// instructions. Builds with AVX give the double vector the same treatment in a 32-byte register.
+// Define RTW_NO_SIMD to keep every vector in plain three-component form.
+
+#if !defined(RTW_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define RTW_SSE 1
+#include <emmintrin.h>
+#if defined(__AVX__)
+#define RTW_AVX 1
+#include <immintrin.h>
+#endif
+#endif
+
+template<typename T>
+struct vec3_layout
+{
+	static constexpr int lanes = 3;
+	static constexpr size_t alignment = alignof(T);
+};
+
+#ifdef RTW_SSE
+template<>
+struct vec3_layout<float>
+{
+	static constexpr int lanes = 4;
+	static constexpr size_t alignment = 16;
+};
+#endif
+
+#ifdef RTW_AVX
+template<>
+struct vec3_layout<double>
+{
+	static constexpr int lanes = 4;
+	static constexpr size_t alignment = 32;
+};
+#endif
+
+template<typename T>
+class vec3_t
 {
 public:
-	double e[3];
+	using scalar = T;
+
+	alignas(vec3_layout<T>::alignment) T e[vec3_layout<T>::lanes];
 
-	vec3() : e{ 0,0,0 } {}
-	vec3(double e0, double e1, double e2) : e{ e0, e1, e2 } {}
+	vec3_t() : e{ 0,0,0 } {}
+	vec3_t(T e0, T e1, T e2) : e{ e0, e1, e2 } {}
 
-	double x() const { return e[0]; }
-	double y() const { return e[1]; }
-	double z() const { return e[2]; }
+	T x() const { return e[0]; }
+	T y() const { return e[1]; }
+	T z() const { return e[2]; }
 
-	vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-	double operator[](int i) const { return e[i]; }
-	double& operator[](int i) { return e[i]; }
+	vec3_t operator-() const { return vec3_t(-e[0], -e[1], -e[2]); }
+	T operator[](int i) const { return e[i]; }
+	T& operator[](int i) { return e[i]; }
 
-	vec3& operator+=(const vec3& v)
+	vec3_t& operator+=(const vec3_t& v)
 	{
-		e[0] += v.e[0];
-		e[1] += v.e[1];
-		e[2] += v.e[2];
-		return *this;
+		return *this = *this + v;
 	}
 
-	vec3& operator*=(double t)
+	vec3_t& operator*=(T t)
 	{
-		e[0] *= t;
-		e[1] *= t;
-		e[2] *= t;
-		return *this;
+		return *this = t * *this;
 	}
 
-	vec3& operator/=(double t)
+	vec3_t& operator/=(T t)
 	{
 		return *this *= 1 / t;
 	}
 
-	double length() const
+	T length() const
 	{
 		return std::sqrt(length_squared());
 	}
 
-	double length_squared() const
+	T length_squared() const
 	{
-		return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+		return dot(*this, *this);
 	}
 
 	bool near_zero() const
 	{
 		// Return true if the vector is close to zero in all dimensions.
-		double s = 1e-8;
+		T s = T(1e-8);
 		return ((std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s));
 	}
 
-	static vec3 random()
+	static vec3_t random()
+	{
+		return vec3_t(random_double(), random_double(), random_double());
+	}
+
+	static vec3_t random(double min, double max)
 	{
-		return vec3(random_double(), random_double(), random_double());
+		return vec3_t(random_double(min, max), random_double(min, max), random_double(min, max));
 	}
 
-	static vec3 random(double min, double max)
+	static vec3_t random(sampler& s, double min, double max)
 	{
-		return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+		double x = random_double(s, min, max);
+		double y = random_double(s, min, max);
+		double z = random_double(s, min, max);
+		return vec3_t(x, y, z);
 	}
 };
 
+using vec3 = vec3_t<real>;
+
 // point3 is just an alias for vec3, but useful for geometric clarity in the code.
 using point3 = vec3;
 
 
 // Vector Utility Functions
+//
+// The scalar arguments are spelled vec3_t<T>::scalar so they take part in no deduction, which
+// lets a double constant scale a float vector without a cast.
 
-inline std::ostream& operator<<(std::ostream& out, const vec3& v)
+template<typename T>
+inline std::ostream& operator<<(std::ostream& out, const vec3_t<T>& v)
 {
 	return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
-inline vec3 operator+(const vec3& u, const vec3& v)
+template<typename T>
+inline vec3_t<T> operator+(const vec3_t<T>& u, const vec3_t<T>& v)
 {
-	return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
+	return vec3_t<T>(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
 
-inline vec3 operator-(const vec3& u, const vec3& v)
+template<typename T>
+inline vec3_t<T> operator-(const vec3_t<T>& u, const vec3_t<T>& v)
 {
-	return vec3(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
+	return vec3_t<T>(u.e[0] - v.e[0], u.e[1] - v.e[1], u.e[2] - v.e[2]);
 }
 
-inline vec3 operator*(const vec3& u, const vec3& v)
+template<typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& u, const vec3_t<T>& v)
 {
-	return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
+	return vec3_t<T>(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3& v)
+template<typename T>
+inline vec3_t<T> operator*(typename vec3_t<T>::scalar t, const vec3_t<T>& v)
 {
-	return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
+	return vec3_t<T>(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline vec3 operator*(const vec3& v, double t)
+template<typename T>
+inline vec3_t<T> operator*(const vec3_t<T>& v, typename vec3_t<T>::scalar t)
 {
 	return t * v;
 }
 
-inline vec3 operator/(const vec3& v, double t)
+template<typename T>
+inline vec3_t<T> operator/(const vec3_t<T>& v, typename vec3_t<T>::scalar t)
 {
 	return (1 / t) * v;
 }
 
-inline double dot(const vec3& u, const vec3& v)
+template<typename T>
+inline T dot(const vec3_t<T>& u, const vec3_t<T>& v)
 {
 	return u.e[0] * v.e[0]
 		+ u.e[1] * v.e[1]
 		+ u.e[2] * v.e[2];
 }
 
-inline vec3 cross(const vec3& u, const vec3& v)
+template<typename T>
+inline vec3_t<T> cross(const vec3_t<T>& u, const vec3_t<T>& v)
 {
-	return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
-				u.e[2] * v.e[0] - u.e[0] * v.e[2],
-				u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+	return vec3_t<T>(u.e[1] * v.e[2] - u.e[2] * v.e[1],
+					 u.e[2] * v.e[0] - u.e[0] * v.e[2],
+					 u.e[0] * v.e[1] - u.e[1] * v.e[0]);
 }
 
-inline vec3 unit_vector(const vec3& v)
+template<typename T>
+inline vec3_t<T> unit_vector(const vec3_t<T>& v)
 {
 	return v / v.length();
 }
 
-inline vec3 random_in_unit_disk()
+#ifdef RTW_SSE
+// Four-lane float versions. Non-template overloads win over the templates above. The unused
+// fourth lane stays zero through every operation here except a division of the zero vector,
+// and dot never reads it.
+
+namespace vec3_simd
+{
+	inline __m128 load(const vec3_t<float>& v) { return _mm_load_ps(v.e); }
+
+	inline vec3_t<float> store(__m128 lanes)
+	{
+		vec3_t<float> v;
+		_mm_store_ps(v.e, lanes);
+		return v;
+	}
+
+	inline __m128 yzx(__m128 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1)); }
+}
+
+inline vec3_t<float> operator+(const vec3_t<float>& u, const vec3_t<float>& v)
+{
+	return vec3_simd::store(_mm_add_ps(vec3_simd::load(u), vec3_simd::load(v)));
+}
+
+inline vec3_t<float> operator-(const vec3_t<float>& u, const vec3_t<float>& v)
+{
+	return vec3_simd::store(_mm_sub_ps(vec3_simd::load(u), vec3_simd::load(v)));
+}
+
+inline vec3_t<float> operator*(const vec3_t<float>& u, const vec3_t<float>& v)
+{
+	return vec3_simd::store(_mm_mul_ps(vec3_simd::load(u), vec3_simd::load(v)));
+}
+
+inline vec3_t<float> operator*(float t, const vec3_t<float>& v)
+{
+	return vec3_simd::store(_mm_mul_ps(_mm_set1_ps(t), vec3_simd::load(v)));
+}
+
+inline vec3_t<float> operator*(const vec3_t<float>& v, float t)
+{
+	return t * v;
+}
+
+inline vec3_t<float> operator/(const vec3_t<float>& v, float t)
+{
+	return (1 / t) * v;
+}
+
+inline float dot(const vec3_t<float>& u, const vec3_t<float>& v)
+{
+	// Horizontal sum of x, y and z in the same order as the scalar version.
+	__m128 products = _mm_mul_ps(vec3_simd::load(u), vec3_simd::load(v));
+	__m128 sum = _mm_add_ss(products, _mm_shuffle_ps(products, products, _MM_SHUFFLE(1, 1, 1, 1)));
+	sum = _mm_add_ss(sum, _mm_movehl_ps(products, products));
+	return _mm_cvtss_f32(sum);
+}
+
+inline vec3_t<float> cross(const vec3_t<float>& u, const vec3_t<float>& v)
+{
+	// u * v.yzx - u.yzx * v gives the cross product rotated to (z, x, y); one more rotation
+	// puts it in place.
+	__m128 a = vec3_simd::load(u);
+	__m128 b = vec3_simd::load(v);
+	__m128 rotated = _mm_sub_ps(_mm_mul_ps(a, vec3_simd::yzx(b)), _mm_mul_ps(vec3_simd::yzx(a), b));
+	return vec3_simd::store(vec3_simd::yzx(rotated));
+}
+
+inline vec3_t<float> unit_vector(const vec3_t<float>& v)
+{
+	__m128 length = _mm_sqrt_ps(_mm_set1_ps(dot(v, v)));
+	return vec3_simd::store(_mm_div_ps(vec3_simd::load(v), length));
+}
+#endif
+
+#ifdef RTW_AVX
+// Four-lane double versions, under the same rules as the float ones.
+
+namespace vec3_simd
+{
+	inline __m256d load(const vec3_t<double>& v) { return _mm256_load_pd(v.e); }
+
+	inline vec3_t<double> store(__m256d lanes)
+	{
+		vec3_t<double> v;
+		_mm256_store_pd(v.e, lanes);
+		return v;
+	}
+}
+
+inline vec3_t<double> operator+(const vec3_t<double>& u, const vec3_t<double>& v)
+{
+	return vec3_simd::store(_mm256_add_pd(vec3_simd::load(u), vec3_simd::load(v)));
+}
+
+inline vec3_t<double> operator-(const vec3_t<double>& u, const vec3_t<double>& v)
+{
+	return vec3_simd::store(_mm256_sub_pd(vec3_simd::load(u), vec3_simd::load(v)));
+}
+
+inline vec3_t<double> operator*(const vec3_t<double>& u, const vec3_t<double>& v)
+{
+	return vec3_simd::store(_mm256_mul_pd(vec3_simd::load(u), vec3_simd::load(v)));
+}
+
+inline vec3_t<double> operator*(double t, const vec3_t<double>& v)
+{
+	return vec3_simd::store(_mm256_mul_pd(_mm256_set1_pd(t), vec3_simd::load(v)));
+}
+
+inline vec3_t<double> operator*(const vec3_t<double>& v, double t)
+{
+	return t * v;
+}
+
+inline vec3_t<double> operator/(const vec3_t<double>& v, double t)
+{
+	return (1 / t) * v;
+}
+
+inline double dot(const vec3_t<double>& u, const vec3_t<double>& v)
+{
+	__m256d products = _mm256_mul_pd(vec3_simd::load(u), vec3_simd::load(v));
+	__m128d xy = _mm256_castpd256_pd128(products);
+	__m128d zw = _mm256_extractf128_pd(products, 1);
+	__m128d sum = _mm_add_sd(xy, _mm_unpackhi_pd(xy, xy));
+	return _mm_cvtsd_f64(_mm_add_sd(sum, zw));
+}
+
+#ifdef __AVX2__
+inline vec3_t<double> cross(const vec3_t<double>& u, const vec3_t<double>& v)
+{
+	// Lane rotation across the two halves needs AVX2; plain AVX builds use the scalar cross.
+	__m256d a = vec3_simd::load(u);
+	__m256d b = vec3_simd::load(v);
+	__m256d a_yzx = _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 0, 2, 1));
+	__m256d b_yzx = _mm256_permute4x64_pd(b, _MM_SHUFFLE(3, 0, 2, 1));
+	__m256d rotated = _mm256_sub_pd(_mm256_mul_pd(a, b_yzx), _mm256_mul_pd(a_yzx, b));
+	return vec3_simd::store(_mm256_permute4x64_pd(rotated, _MM_SHUFFLE(3, 0, 2, 1)));
+}
+#endif
+
+inline vec3_t<double> unit_vector(const vec3_t<double>& v)
+{
+	__m256d length = _mm256_set1_pd(std::sqrt(dot(v, v)));
+	return vec3_simd::store(_mm256_div_pd(vec3_simd::load(v), length));
+}
+#endif
+
+template<typename T>
+inline T max_abs_component(const vec3_t<T>& v)
+{
+	return std::fmax(std::fabs(v.e[0]), std::fmax(std::fabs(v.e[1]), std::fabs(v.e[2])));
+}
+
+template<typename T>
+inline vec3_t<T> offset_ray_origin(const vec3_t<T>& p, const vec3_t<T>& n, T p_error)
+{
+	// Moves a surface point along the normal n far enough that no point within p_error of it
+	// (per component) lies behind the surface, then one ulp further along each axis so the
+	// rounding of the move cannot pull it back (Pharr, Jakob and Humphreys, "Physically Based
+	// Rendering", 3rd edition, section 3.9.5). A ray leaving from the result can be traced
+	// from t = 0 without finding the surface it starts on.
+
+	T distance = p_error * (std::fabs(n.e[0]) + std::fabs(n.e[1]) + std::fabs(n.e[2]));
+	vec3_t<T> offset = distance * n;
+	vec3_t<T> moved = p + offset;
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		if (offset.e[axis] > 0)
+		{
+			moved.e[axis] = std::nextafter(moved.e[axis], std::numeric_limits<T>::infinity());
+		}
+		else if (offset.e[axis] < 0)
+		{
+			moved.e[axis] = std::nextafter(moved.e[axis], -std::numeric_limits<T>::infinity());
+		}
+	}
+
+	return moved;
+}
+
+inline vec3 random_in_unit_disk(sampler& s)
 {
 	while (true)
 	{
-		vec3 p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
+		double x = random_double(s, -1, 1);
+		double y = random_double(s, -1, 1);
+		vec3 p = vec3(x, y, 0);
 		if (p.length_squared() < 1)
 		{
 			return p;
@@ -138,11 +385,11 @@ inline vec3 random_in_unit_disk()
 	}
 }
 
-inline vec3 random_unit_vector()
+inline vec3 random_unit_vector(sampler& s)
 {
 	while (true)
 	{
-		vec3 p = vec3::random(-1, 1);
+		vec3 p = vec3::random(s, -1, 1);
 		double lensq = p.length_squared();
 		if (1e-160 < lensq && lensq <= 1)
 		{
@@ -151,9 +398,9 @@ inline vec3 random_unit_vector()
 	}
 }
 
-inline vec3 random_on_hemisphere(const vec3& normal)
+inline vec3 random_on_hemisphere(sampler& s, const vec3& normal)
 {
-	vec3 on_unit_sphere = random_unit_vector();
+	vec3 on_unit_sphere = random_unit_vector(s);
 	if (dot(on_unit_sphere, normal) > 0.0) // In the same hemisphere as the normal
 	{
 		return on_unit_sphere;
@@ -177,11 +424,11 @@ inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat)
 	return r_out_perp + r_out_parallel;
 }
 
-inline vec3 random_in_unit_sphere()
+inline vec3 random_in_unit_sphere(sampler& s)
 {
 	while (true)
 	{
-		vec3 p = vec3::random(-1, 1);
+		vec3 p = vec3::random(s, -1, 1);
 		if (p.length_squared() < 1)
 		{
 			return p;
@@ -189,10 +436,10 @@ inline vec3 random_in_unit_sphere()
 	}
 }
 
-inline vec3 random_cosine_direction()
+inline vec3 random_cosine_direction(sampler& s)
 {
-	double r1 = random_double();
-	double r2 = random_double();
+	double r1 = random_double(s);
+	double r2 = random_double(s);
 
 	double phi = 2 * pi * r1;
 	double x = std::cos(phi) * std::sqrt(r2);
@@ -202,4 +449,4 @@ inline vec3 random_cosine_direction()
 	return vec3(x, y, z);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,275 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "material.h"
+#include "parallel.h"
+
+#include <cstdint>
+#include <mutex>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+// Ray queues for the wavefront integrator. They are stored structure-of-arrays so each stage
+// streams through only the fields it touches, and queue slot k of every stage belongs to the
+// same path for the length of one bounce.
+
+struct path_queue
+{
+    // Rays the live paths trace next, with the path state that rides along.
+
+    std::vector<real>     origin_x, origin_y, origin_z;
+    std::vector<real>     direction_x, direction_y, direction_z;
+    std::vector<real>     time;
+    std::vector<real>     throughput_r, throughput_g, throughput_b;
+    std::vector<uint32_t> path;             // Index of the path within its batch
+    std::vector<char>     count_emission;   // Whether emitters hit next add their light
+    size_t size = 0;
+
+    void reserve(size_t capacity)
+    {
+        for (std::vector<real>* field : { &origin_x, &origin_y, &origin_z, &direction_x, &direction_y,
+                                            &direction_z, &time, &throughput_r, &throughput_g, &throughput_b })
+        {
+            field->resize(capacity);
+        }
+        path.resize(capacity);
+        count_emission.resize(capacity);
+    }
+
+    ray get_ray(size_t k) const
+    {
+        return ray(point3(origin_x[k], origin_y[k], origin_z[k]),
+                   vec3(direction_x[k], direction_y[k], direction_z[k]), time[k]);
+    }
+
+    color throughput(size_t k) const
+    {
+        return color(throughput_r[k], throughput_g[k], throughput_b[k]);
+    }
+
+    void set(size_t k, const ray& r, const color& path_throughput, uint32_t path_index, bool emission)
+    {
+        origin_x[k] = r.origin().x();
+        origin_y[k] = r.origin().y();
+        origin_z[k] = r.origin().z();
+        direction_x[k] = r.direction().x();
+        direction_y[k] = r.direction().y();
+        direction_z[k] = r.direction().z();
+        time[k] = r.time();
+        throughput_r[k] = path_throughput.x();
+        throughput_g[k] = path_throughput.y();
+        throughput_b[k] = path_throughput.z();
+        path[k] = path_index;
+        count_emission[k] = char(emission);
+    }
+
+    void copy_entry(const path_queue& from, size_t k_from, size_t k_to)
+    {
+        origin_x[k_to] = from.origin_x[k_from];
+        origin_y[k_to] = from.origin_y[k_from];
+        origin_z[k_to] = from.origin_z[k_from];
+        direction_x[k_to] = from.direction_x[k_from];
+        direction_y[k_to] = from.direction_y[k_from];
+        direction_z[k_to] = from.direction_z[k_from];
+        time[k_to] = from.time[k_from];
+        throughput_r[k_to] = from.throughput_r[k_from];
+        throughput_g[k_to] = from.throughput_g[k_from];
+        throughput_b[k_to] = from.throughput_b[k_from];
+        path[k_to] = from.path[k_from];
+        count_emission[k_to] = from.count_emission[k_from];
+    }
+};
+
+struct shadow_queue
+{
+    // Next-event estimation rays, each with the light it delivers to its path if unblocked.
+    // Slot k holds the shadow ray of path queue slot k; `active` marks the slots in use.
+
+    std::vector<real>     origin_x, origin_y, origin_z;
+    std::vector<real>     direction_x, direction_y, direction_z;
+    std::vector<real>     time, t_max;
+    std::vector<real>     direct_r, direct_g, direct_b;
+    std::vector<char>     active;
+
+    void reserve(size_t capacity)
+    {
+        for (std::vector<real>* field : { &origin_x, &origin_y, &origin_z, &direction_x, &direction_y,
+                                            &direction_z, &time, &t_max, &direct_r, &direct_g, &direct_b })
+        {
+            field->resize(capacity);
+        }
+        active.resize(capacity);
+    }
+
+    ray get_ray(size_t k) const
+    {
+        return ray(point3(origin_x[k], origin_y[k], origin_z[k]),
+                   vec3(direction_x[k], direction_y[k], direction_z[k]), time[k]);
+    }
+
+    color direct(size_t k) const
+    {
+        return color(direct_r[k], direct_g[k], direct_b[k]);
+    }
+
+    void set(size_t k, const ray& r, double ray_t_max, const color& contribution)
+    {
+        origin_x[k] = r.origin().x();
+        origin_y[k] = r.origin().y();
+        origin_z[k] = r.origin().z();
+        direction_x[k] = r.direction().x();
+        direction_y[k] = r.direction().y();
+        direction_z[k] = r.direction().z();
+        time[k] = r.time();
+        t_max[k] = ray_t_max;
+        direct_r[k] = contribution.x();
+        direct_g[k] = contribution.y();
+        direct_b[k] = contribution.z();
+        active[k] = 1;
+    }
+};
+
+inline size_t compact_paths(const path_queue& from, const std::vector<char>& alive, path_queue& to,
+                            size_t chunk_size, int thread_count)
+{
+    // Copies the entries of `from` whose alive flag is set to the front of `to`, preserving
+    // their order, and returns how many there were. Each chunk counts its survivors, a prefix
+    // sum turns the counts into output offsets, and the chunks then copy in parallel.
+
+    size_t count = from.size;
+    int chunk_count = int((count + chunk_size - 1) / chunk_size);
+    std::vector<size_t> offsets(size_t(chunk_count) + 1, 0);
+
+    parallel_for(chunk_count, thread_count, [&](int chunk, int worker)
+    {
+        size_t end = std::min(count, (chunk + 1) * chunk_size);
+        size_t survivors = 0;
+        for (size_t k = chunk * chunk_size; k < end; k++)
+        {
+            survivors += (alive[k] ? 1 : 0);
+        }
+        offsets[size_t(chunk) + 1] = survivors;
+    });
+
+    for (int chunk = 0; chunk < chunk_count; chunk++)
+    {
+        offsets[size_t(chunk) + 1] += offsets[chunk];
+    }
+
+    parallel_for(chunk_count, thread_count, [&](int chunk, int worker)
+    {
+        size_t end = std::min(count, (chunk + 1) * chunk_size);
+        size_t out = offsets[chunk];
+        for (size_t k = chunk * chunk_size; k < end; k++)
+        {
+            if (alive[k])
+            {
+                to.copy_entry(from, k, out++);
+            }
+        }
+    });
+
+    to.size = offsets[chunk_count];
+    return to.size;
+}
+
+class material_sort
+{
+public:
+    // Orders the queue slots by the concrete type of the material they hit, misses first, so
+    // each shading run keeps dispatching the same scatter code. Types are numbered as they are
+    // first met. Every worker keeps its own material-to-group map, so the shared type table
+    // behind the lock is only consulted when a worker meets a material for the first time.
+
+    void reserve(size_t capacity, size_t chunk_size, int thread_count)
+    {
+        group.resize(capacity);
+        chunk_counts.resize((capacity + chunk_size - 1) / chunk_size);
+        worker_groups.resize(size_t(resolve_thread_count(thread_count)));
+    }
+
+    void sort(size_t count, const std::vector<char>& did_hit, const std::vector<hit_record>& hits,
+              std::vector<uint32_t>& order, size_t chunk_size, int thread_count)
+    {
+        // Counting sort in the shape of compact_paths(): each chunk counts its slots per
+        // group, a prefix sum turns the counts into output offsets, and the chunks scatter in
+        // parallel. Within a group the slots keep their queue order.
+
+        int chunk_count = int((count + chunk_size - 1) / chunk_size);
+
+        parallel_for(chunk_count, thread_count, [&](int chunk, int worker)
+        {
+            std::unordered_map<const material*, uint16_t>& known = worker_groups[worker];
+            std::vector<size_t>& counts = chunk_counts[chunk];
+            counts.assign(counts.size(), 0);
+
+            size_t end = std::min(count, (chunk + 1) * chunk_size);
+            for (size_t k = chunk * chunk_size; k < end; k++)
+            {
+                uint16_t g = 0;
+                if (did_hit[k])
+                {
+                    auto found = known.find(hits[k].mat);
+                    if (found == known.end())
+                    {
+                        found = known.emplace(hits[k].mat, type_group(hits[k].mat)).first;
+                    }
+                    g = found->second;
+                }
+
+                group[k] = g;
+                if (g >= counts.size())
+                {
+                    counts.resize(size_t(g) + 1, 0);
+                }
+                counts[g]++;
+            }
+        });
+
+        // Group-major, so every chunk's slots of one group land after the previous chunk's.
+        size_t group_count = type_groups.size() + 1;
+        size_t offset = 0;
+        for (size_t g = 0; g < group_count; g++)
+        {
+            for (int chunk = 0; chunk < chunk_count; chunk++)
+            {
+                std::vector<size_t>& counts = chunk_counts[chunk];
+                if (counts.size() < group_count)
+                {
+                    counts.resize(group_count, 0);
+                }
+
+                size_t slots = counts[g];
+                counts[g] = offset;
+                offset += slots;
+            }
+        }
+
+        parallel_for(chunk_count, thread_count, [&](int chunk, int worker)
+        {
+            std::vector<size_t>& offsets = chunk_counts[chunk];
+            size_t end = std::min(count, (chunk + 1) * chunk_size);
+            for (size_t k = chunk * chunk_size; k < end; k++)
+            {
+                order[offsets[group[k]]++] = uint32_t(k);
+            }
+        });
+    }
+
+private:
+    std::vector<uint16_t> group;
+    std::vector<std::vector<size_t>> chunk_counts;
+    std::vector<std::unordered_map<const material*, uint16_t>> worker_groups;
+    std::unordered_map<std::type_index, uint16_t> type_groups;
+    std::mutex mutex;
+
+    uint16_t type_group(const material* mat)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint16_t next = uint16_t(type_groups.size() + 1);
+        return type_groups.emplace(std::type_index(typeid(*mat)), next).first->second;
+    }
+};
+
+#endif
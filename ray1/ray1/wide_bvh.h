@@ -0,0 +1,323 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "aabb.h"
+#include "hittable.h"
+#include "linear_bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+template<int Width>
+struct alignas(64) wide_bvh_node
+{
+    // One node of a 4- or 8-wide BVH. The child boxes are stored structure-of-arrays in float,
+    // so one SIMD slab test covers a register's worth of children. Child slot i is either an
+    // interior node (count[i] == 0, offset[i] its node index) or a leaf stored inline
+    // (count[i] primitives starting at offset[i]). Unused slots hold an inverted box that no
+    // ray can enter.
+
+    float    bounds_min[3][Width];
+    float    bounds_max[3][Width];
+    uint32_t offset[Width];
+    uint16_t count[Width];
+};
+
+template<int Width>
+class wide_bvh : public hittable
+{
+public:
+    static_assert(Width == 4 || Width == 8, "wide BVH nodes are 4 or 8 children wide");
+
+    // Deepest chain of nodes the traversal stack can hold; see linear_bvh::max_depth.
+    static const int max_depth = linear_bvh::max_depth;
+
+    wide_bvh() {}
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        return closest_hit<false>(r, ray_t, rec, nullptr);
+    }
+
+    void count_traversal(const ray& r, interval ray_t, bvh_traversal_stats& stats) const
+    {
+        hit_record rec;
+        closest_hit<true>(r, ray_t, rec, &stats);
+        stats.rays++;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override
+    {
+        // Any hit ends the query, so children are visited in slot order without sorting.
+
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        ray_lanes lanes_of_ray(r);
+        alignas(64) real t_entry[Width];
+
+        stack_entry stack[max_depth * Width];
+        int stack_size = 0;
+        stack[stack_size++] = { 0, 0, ray_t.min };
+
+        while (stack_size > 0)
+        {
+            stack_entry entry = stack[--stack_size];
+
+            if (entry.count > 0)
+            {
+                for (uint32_t i = 0; i < entry.count; i++)
+                {
+                    if (primitives[entry.offset + i]->occluded(r, ray_t))
+                    {
+                        return true;
+                    }
+                }
+                continue;
+            }
+
+            const wide_bvh_node<Width>& node = nodes[entry.offset];
+            uint32_t hit_mask = child_hits(node, lanes_of_ray, ray_t.min, ray_t.max, t_entry);
+            for (int slot = 0; slot < Width; slot++)
+            {
+                if ((hit_mask >> slot) & 1)
+                {
+                    stack[stack_size++] = { node.offset[slot], node.count[slot], t_entry[slot] };
+                }
+            }
+        }
+
+        return false;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    void hash_content(uint64_t& hash) const override
+    {
+        hash_type(hash, typeid(*this));
+        hash_values(hash, { double(owners.size()) });
+        for (const shared_ptr<hittable>& object : owners)
+        {
+            object->hash_content(hash);
+        }
+    }
+
+    size_t node_count() const { return nodes.size(); }
+    size_t node_bytes() const { return sizeof(wide_bvh_node<Width>); }
+    size_t primitive_count() const { return primitives.size(); }
+
+    // Builder interface: add a node, then fill its child slots.
+
+    uint32_t add_node(const aabb& box)
+    {
+        if (nodes.empty())
+        {
+            bbox = box;
+        }
+
+        wide_bvh_node<Width> node = {};
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (int slot = 0; slot < Width; slot++)
+            {
+                node.bounds_min[axis][slot] = std::numeric_limits<float>::infinity();
+                node.bounds_max[axis][slot] = -std::numeric_limits<float>::infinity();
+            }
+        }
+
+        nodes.push_back(node);
+        return uint32_t(nodes.size() - 1);
+    }
+
+    void set_child_node(uint32_t node, int slot, const aabb& box, uint32_t child)
+    {
+        set_child_box(node, slot, box);
+        nodes[node].offset[slot] = child;
+        nodes[node].count[slot] = 0;
+    }
+
+    void set_child_leaf(uint32_t node, int slot, const aabb& box, const std::vector<shared_ptr<hittable>>& leaf_objects)
+    {
+        // An empty leaf keeps the slot's inverted box, since a count of zero means interior.
+        if (leaf_objects.empty())
+        {
+            return;
+        }
+
+        set_child_box(node, slot, box);
+        nodes[node].offset[slot] = uint32_t(primitives.size());
+        nodes[node].count[slot] = uint16_t(leaf_objects.size());
+
+        for (const shared_ptr<hittable>& object : leaf_objects)
+        {
+            primitives.push_back(object.get());
+            owners.push_back(object);
+        }
+    }
+
+private:
+    std::vector<wide_bvh_node<Width>> nodes;
+    std::vector<const hittable*> primitives;      // Raw pointers, so leaves never touch refcounts
+    std::vector<shared_ptr<hittable>> owners;     // Keeps the primitives alive
+    aabb bbox;
+
+    struct stack_entry
+    {
+        // A child still to visit: a node index, or a leaf's primitive range when count > 0,
+        // with the distance at which the ray enters its box.
+        uint32_t offset;
+        uint32_t count;
+        real t_entry;
+    };
+
+    struct ray_lanes
+    {
+        // The ray's origin and inverse direction broadcast across SIMD lanes once per query.
+
+        packet_simd::lanes_t origin[3];
+        packet_simd::lanes_t inv_direction[3];
+        int sign[3];
+
+        explicit ray_lanes(const ray& r)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                origin[axis] = packet_simd::broadcast(r.origin()[axis]);
+                inv_direction[axis] = packet_simd::broadcast(r.inv_direction()[axis]);
+                sign[axis] = r.dir_sign(axis);
+            }
+        }
+    };
+
+    void set_child_box(uint32_t node, int slot, const aabb& box)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            const interval& extent = box.axis_interval(axis);
+            nodes[node].bounds_min[axis][slot] = round_down_to_float(extent.min);
+            nodes[node].bounds_max[axis][slot] = round_up_to_float(extent.max);
+        }
+    }
+
+    template<bool count_steps>
+    bool closest_hit(const ray& r, interval ray_t, hit_record& rec, bvh_traversal_stats* stats) const
+    {
+        // Pops the nearest pending child first: each node's hit children are pushed farthest
+        // first, and a child whose box starts beyond the closest hit so far is dropped when it
+        // is popped.
+
+        if (nodes.empty())
+        {
+            return false;
+        }
+
+        bool hit_anything = false;
+        real closest_so_far = ray_t.max;
+
+        ray_lanes lanes_of_ray(r);
+        alignas(64) real t_entry[Width];
+
+        stack_entry stack[max_depth * Width];
+        int stack_size = 0;
+        stack[stack_size++] = { 0, 0, ray_t.min };
+
+        while (stack_size > 0)
+        {
+            stack_entry entry = stack[--stack_size];
+            if (entry.t_entry >= closest_so_far)
+            {
+                continue;
+            }
+
+            if (entry.count > 0)
+            {
+                for (uint32_t i = 0; i < entry.count; i++)
+                {
+                    if (primitives[entry.offset + i]->hit(r, interval(ray_t.min, closest_so_far), rec))
+                    {
+                        hit_anything = true;
+                        closest_so_far = real(rec.t);
+                    }
+                }
+                if (count_steps)
+                {
+                    stats->primitive_tests += entry.count;
+                }
+                continue;
+            }
+
+            const wide_bvh_node<Width>& node = nodes[entry.offset];
+            uint32_t hit_mask = child_hits(node, lanes_of_ray, ray_t.min, closest_so_far, t_entry);
+            if (count_steps)
+            {
+                stats->node_visits++;
+                stats->box_tests += Width;
+            }
+
+            // Insertion sort of the hit children by entry distance, nearest first.
+            int order[Width];
+            int hit_count = 0;
+            for (int slot = 0; slot < Width; slot++)
+            {
+                if ((hit_mask >> slot) & 1)
+                {
+                    int i = hit_count++;
+                    while (i > 0 && t_entry[order[i - 1]] > t_entry[slot])
+                    {
+                        order[i] = order[i - 1];
+                        i--;
+                    }
+                    order[i] = slot;
+                }
+            }
+
+            for (int i = hit_count - 1; i >= 0; i--)
+            {
+                int slot = order[i];
+                stack[stack_size++] = { node.offset[slot], node.count[slot], t_entry[slot] };
+            }
+        }
+
+        return hit_anything;
+    }
+
+    static uint32_t child_hits(const wide_bvh_node<Width>& node, const ray_lanes& r, real t_min, real t_max,
+                               real* t_entry)
+    {
+        // The slab test of linear_bvh's node_hit() against every child box, a SIMD register
+        // of children at a time. Returns a bit per child whose box the ray enters within
+        // [t_min, t_max], and writes each child's entry distance to t_entry.
+
+        using namespace packet_simd;
+
+        uint32_t result = 0;
+        for (int group = 0; group < Width; group += lanes)
+        {
+            lanes_t near_t = broadcast(t_min);
+            lanes_t far_t = broadcast(t_max);
+
+            for (int axis = 0; axis < 3; axis++)
+            {
+                lanes_t bounds_min = load_float(node.bounds_min[axis] + group);
+                lanes_t bounds_max = load_float(node.bounds_max[axis] + group);
+                lanes_t t_near = mul(sub(r.sign[axis] ? bounds_max : bounds_min, r.origin[axis]), r.inv_direction[axis]);
+                lanes_t t_far = mul(sub(r.sign[axis] ? bounds_min : bounds_max, r.origin[axis]), r.inv_direction[axis]);
+
+                near_t = max(t_near, near_t);
+                far_t = min(t_far, far_t);
+            }
+
+            store(t_entry + group, near_t);
+            result |= bits(less(near_t, far_t)) << group;
+        }
+
+        return result;
+    }
+};
+
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+#endif
@@ -208,34 +208,36 @@ void camera::initialize()
     defocus_disk_v = v * defocus_radius;
 }
 
-ray camera::get_ray(int i, int j) const
+ray camera::get_ray(int i, int j, sampler& s) const
 {
     // Construct a camera ray originating from the origin and directed at randomly sampled
     // point around the pixel location i, j.
 
-    vec3 offset = sample_square();
+    vec3 offset = sample_square(s);
     vec3 pixel_sample = pixel00_loc + ((i + offset.x()) * pixel_delta_u) + ((j + offset.y()) * pixel_delta_v);
 
-    vec3 ray_origin = ((defocus_angle <= 0) ? center : defocus_disk_sample());
+    vec3 ray_origin = ((defocus_angle <= 0) ? center : defocus_disk_sample(s));
     vec3 ray_direction = pixel_sample - ray_origin;
 
     return ray(ray_origin, ray_direction);
 }
 
-vec3 camera::sample_square() const
+vec3 camera::sample_square(sampler& s) const
 {
     // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square.
-    return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+    double px = random_double(s) - 0.5;
+    double py = random_double(s) - 0.5;
+    return vec3(px, py, 0);
 }
 
-point3 camera::defocus_disk_sample() const
+point3 camera::defocus_disk_sample(sampler& s) const
 {
     // Returns a random point in the camera defocus disk.
-    vec3 p = random_in_unit_disk();
+    vec3 p = random_in_unit_disk(s);
     return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
 }
 
-color camera::ray_color(const ray& r, int depth, const hittable& world) const
+color camera::ray_color(const ray& r, int depth, const hittable& world, sampler& s) const
 {
     // If we've exceeded the ray bounce limit, no more light is gathered.
     if (depth <= 0)
@@ -243,15 +245,17 @@ color camera::ray_color(const ray& r, int depth, const hittable& world) const
         return color(0, 0, 0);
     }
 
+    s.start_bounce((uint32_t)depth);
+
     hit_record rec;
 
     if (world.hit(r, interval(0.001, infinity), rec))
     {
         ray scattered;
         color attenuation;
-        if (rec.mat->scatter(r, rec, attenuation, scattered))
+        if (rec.mat->scatter(r, rec, attenuation, scattered, s))
         {
-            return attenuation * ray_color(scattered, depth - 1, world);
+            return attenuation * ray_color(scattered, depth - 1, world, s);
         }
         return color(0, 0, 0);
     }
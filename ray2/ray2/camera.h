@@ -58,13 +58,13 @@ private:
 
     void initialize();
 
-    ray get_ray(int i, int j) const;
+    ray get_ray(int i, int j, sampler& s) const;
 
-    vec3 sample_square() const;
+    vec3 sample_square(sampler& s) const;
 
-    point3 defocus_disk_sample() const;
+    point3 defocus_disk_sample(sampler& s) const;
 
-    color ray_color(const ray& r, int depth, const hittable& world) const;
+    color ray_color(const ray& r, int depth, const hittable& world, sampler& s) const;
 };
 
 #endif
\ No newline at end of file
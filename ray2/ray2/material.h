@@ -8,7 +8,7 @@ class material
 public:
     virtual ~material() = default;
 
-    virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const
+    virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& s) const
     {
         return false;
     }
@@ -19,9 +19,9 @@ class lambertian : public material
 public:
     lambertian(const color& albedo) : albedo(albedo) {}
 
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& s) const override
     {
-        vec3 scatter_direction = rec.normal + random_unit_vector();
+        vec3 scatter_direction = rec.normal + random_unit_vector(s);
 
         // Catch degenerate scatter direction
         if (scatter_direction.near_zero())
@@ -46,10 +46,10 @@ public:
         fuzz(fuzz < 1 ? fuzz : 1)
     {}
 
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& s) const override
     {
         vec3 reflected = reflect(r_in.direction(), rec.normal);
-        reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
+        reflected = unit_vector(reflected) + (fuzz * random_unit_vector(s));
         scattered = ray(rec.p, reflected);
         attenuation = albedo;
         return (dot(scattered.direction(), rec.normal) > 0);
@@ -65,7 +65,7 @@ class dielectric : public material
 public:
     dielectric(double refraction_index) : refraction_index(refraction_index) {}
 
-    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered, sampler& s) const override
     {
         attenuation = color(1.0, 1.0, 1.0);
         double ri = (rec.front_face ? (1.0 / refraction_index) : refraction_index);
@@ -77,7 +77,7 @@ public:
         bool cannot_refract = (ri * sin_theta > 1.0);
         vec3 direction;
 
-        if (cannot_refract || reflectance(cos_theta, ri) > random_double())
+        if (cannot_refract || reflectance(cos_theta, ri) > random_double(s))
         {
             direction = reflect(unit_direction, rec.normal);
         }
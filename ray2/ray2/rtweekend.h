@@ -28,8 +28,10 @@ inline double degrees_to_radians(double degrees)
 
 inline double random_double()
 {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
+    // Used while building scenes. Render threads draw from their own sampler stream instead,
+    // but keep one generator per thread so stray calls from workers never race.
+    thread_local std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    thread_local std::mt19937 generator;
     return distribution(generator);
 }
 
@@ -41,6 +43,8 @@ inline double random_double(double min, double max)
 
 // Common Headers
 
+#include "sampler.h"
+
 #include "color.h"
 #include "interval.h"
 #include "ray.h"
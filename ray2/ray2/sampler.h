@@ -0,0 +1,93 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+
+class sampler
+{
+public:
+    // A counter-based random stream for one camera sample. Every value is a pure hash of
+    // (pixel, sample index, bounce, dimension), so the numbers a path consumes do not depend
+    // on which thread renders it or in what order tiles are visited. There is no shared
+    // generator state to contend on.
+
+    sampler() : pixel(0), sample(0), bounce(0), dimension(0) {}
+
+    sampler(uint32_t pixel, uint32_t sample) : pixel(pixel), sample(sample), bounce(0), dimension(0) {}
+
+    void start_bounce(uint32_t bounce_index)
+    {
+        // Moves the stream to the dimensions reserved for the given path vertex.
+        bounce = bounce_index;
+        dimension = 0;
+    }
+
+    double next()
+    {
+        // Returns a random real in [0,1) with 53 bits of precision.
+
+        uint32_t v[4] = { pixel, sample, bounce, dimension++ };
+        pcg4d(v);
+
+        uint64_t bits = (uint64_t(v[0] >> 5) << 26) | (v[1] >> 6);
+        return double(bits) * (1.0 / 9007199254740992.0);
+    }
+
+    static uint32_t hash(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+    {
+        // Hashes four words down to one; handy for keying streams from other state.
+        uint32_t v[4] = { a, b, c, d };
+        pcg4d(v);
+        return v[0] ^ v[2];
+    }
+
+private:
+    uint32_t pixel;
+    uint32_t sample;
+    uint32_t bounce;
+    uint32_t dimension;
+
+    static void pcg4d(uint32_t v[4])
+    {
+        // The pcg4d permutation from Jarzynski & Olano, "Hash Functions for GPU Rendering".
+
+        for (int i = 0; i < 4; i++)
+        {
+            v[i] = v[i] * 1664525u + 1013904223u;
+        }
+
+        v[0] += v[1] * v[3];
+        v[1] += v[2] * v[0];
+        v[2] += v[0] * v[1];
+        v[3] += v[1] * v[2];
+
+        for (int i = 0; i < 4; i++)
+        {
+            v[i] ^= v[i] >> 16;
+        }
+
+        v[0] += v[1] * v[3];
+        v[1] += v[2] * v[0];
+        v[2] += v[0] * v[1];
+        v[3] += v[1] * v[2];
+    }
+};
+
+inline double random_double(sampler& s)
+{
+    return s.next();
+}
+
+inline double random_double(sampler& s, double min, double max)
+{
+    // Returns a random real in [min,max).
+    return min + (max - min) * random_double(s);
+}
+
+inline int random_int(sampler& s, int min, int max)
+{
+    // Returns a random integer in [min,max].
+    return int(random_double(s, min, max + 1));
+}
+
+#endif
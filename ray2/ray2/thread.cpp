@@ -8,12 +8,14 @@
 #include "sphere.h"
 #include "thread.h"
 
-ray GetRay(int i, int j, camera* pCamera);
-color RayColor(const ray& r, int depth, const hittable& world);
+ray GetRay(int i, int j, camera* pCamera, sampler& s);
+color RayColor(const ray& r, int depth, const hittable& world, sampler& s);
 
-inline vec3 SampleSquare()
+inline vec3 SampleSquare(sampler& s)
 {
-	return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+	double px = random_double(s) - 0.5;
+	double py = random_double(s) - 0.5;
+	return vec3(px, py, 0);
 }
 
 DWORD CountSetBits(ULONG_PTR bitMask)
@@ -188,8 +190,11 @@ UINT WINAPI ThreadFunc(void* pArg)
 						color pixelColor(0, 0, 0);
 						for (int sample = 0; sample < pCamera->samples_per_pixel; ++sample)
 						{
-							ray r = GetRay(i, j, pCamera);
-							pixelColor += RayColor(r, pCamera->max_depth, *pWorld);
+							// Each sample owns a counter-based stream, so the image does not depend on
+							// how scanlines are spread over threads.
+							sampler s((uint32_t)(j * imageWidth + i), (uint32_t)sample);
+							ray r = GetRay(i, j, pCamera, s);
+							pixelColor += RayColor(r, pCamera->max_depth, *pWorld, s);
 						}
 
 						{
@@ -243,7 +248,7 @@ LB_RET:
 	return 0;
 }
 
-ray GetRay(int i, int j, camera* pCamera)
+ray GetRay(int i, int j, camera* pCamera, sampler& s)
 {
 	_ASSERT(pCamera);
 
@@ -278,10 +283,10 @@ ray GetRay(int i, int j, camera* pCamera)
 	// Construct a camera ray originating from the origin and directed at randomly sampled
 	// point around the pixel location i, j.
 
-	vec3 offset = SampleSquare();
+	vec3 offset = SampleSquare(s);
 	vec3 pixel_sample = pixel00Loc + ((i + offset.x()) * pixel_delta_u) + ((j + offset.y()) * pixel_delta_v);
 
-	vec3 p = random_in_unit_disk();
+	vec3 p = random_in_unit_disk(s);
 	vec3 defocusDiskSample = center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
 
 	vec3 ray_origin = ((pCamera->defocus_angle <= 0) ? center : defocusDiskSample);
@@ -290,7 +295,7 @@ ray GetRay(int i, int j, camera* pCamera)
 	return ray(ray_origin, ray_direction);
 }
 
-color RayColor(const ray& r, int depth, const hittable& world)
+color RayColor(const ray& r, int depth, const hittable& world, sampler& s)
 {
 	// If we've exceeded the ray bounce limit, no more light is gathered.
 	if (depth <= 0)
@@ -298,15 +303,17 @@ color RayColor(const ray& r, int depth, const hittable& world)
 		return color(0, 0, 0);
 	}
 
+	s.start_bounce((uint32_t)depth);
+
 	hit_record rec;
 
 	if (world.hit(r, interval(0.001, infinity), rec))
 	{
 		ray scattered;
 		color attenuation;
-		if (rec.mat->scatter(r, rec, attenuation, scattered))
+		if (rec.mat->scatter(r, rec, attenuation, scattered, s))
 		{
-			return attenuation * RayColor(scattered, depth - 1, world);
+			return attenuation * RayColor(scattered, depth - 1, world, s);
 		}
 		return color(0, 0, 0);
 	}
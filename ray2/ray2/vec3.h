@@ -64,6 +64,14 @@ public:
 	{
 		return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
 	}
+
+	static vec3 random(sampler& s, double min, double max)
+	{
+		double x = random_double(s, min, max);
+		double y = random_double(s, min, max);
+		double z = random_double(s, min, max);
+		return vec3(x, y, z);
+	}
 };
 
 // point3 is just an alias for vec3, but useful for geometric clarity in the code.
@@ -126,11 +134,13 @@ inline vec3 unit_vector(const vec3& v)
 	return v / v.length();
 }
 
-inline vec3 random_in_unit_disk()
+inline vec3 random_in_unit_disk(sampler& s)
 {
 	while (true)
 	{
-		vec3 p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
+		double x = random_double(s, -1, 1);
+		double y = random_double(s, -1, 1);
+		vec3 p = vec3(x, y, 0);
 		if (p.length_squared() < 1)
 		{
 			return p;
@@ -138,11 +148,11 @@ inline vec3 random_in_unit_disk()
 	}
 }
 
-inline vec3 random_unit_vector()
+inline vec3 random_unit_vector(sampler& s)
 {
 	while (true)
 	{
-		vec3 p = vec3::random(-1, 1);
+		vec3 p = vec3::random(s, -1, 1);
 		double lensq = p.length_squared();
 		if (1e-160 < lensq && lensq <= 1)
 		{
@@ -151,9 +161,9 @@ inline vec3 random_unit_vector()
 	}
 }
 
-inline vec3 random_on_hemisphere(const vec3& normal)
+inline vec3 random_on_hemisphere(sampler& s, const vec3& normal)
 {
-	vec3 on_unit_sphere = random_unit_vector();
+	vec3 on_unit_sphere = random_unit_vector(s);
 	if (dot(on_unit_sphere, normal) > 0.0) // In the same hemisphere as the normal
 	{
 		return on_unit_sphere;